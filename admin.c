@@ -107,6 +107,7 @@ static void __nvmev_admin_create_cq(int eid)
 
 	dbs_idx = cq->qid * 2 + 1;
 	nvmev_vdev->dbs[dbs_idx] = nvmev_vdev->old_dbs[dbs_idx] = 0;
+	nvmev_dbbuf_update_event(dbs_idx, 0, cq->queue_size);
 
 	__make_cq_entry(eid, NVME_SC_SUCCESS);
 }
@@ -121,7 +122,9 @@ static void __nvmev_admin_delete_cq(int eid)
 	qid = sq_entry(eid).delete_queue.qid;
 
 	cq = nvmev_vdev->cqes[qid];
-	nvmev_vdev->cqes[qid] = NULL;
+	WRITE_ONCE(nvmev_vdev->cqes[qid], NULL);
+	/* Let the other dispatchers finish a round that may still see @cq */
+	nvmev_sync_dispatchers();
 
 	if (cq) {
 		kfree(cq->cq);
@@ -172,6 +175,7 @@ static void __nvmev_admin_create_sq(int eid)
 	dbs_idx = sq->qid * 2;
 	nvmev_vdev->dbs[dbs_idx] = 0;
 	nvmev_vdev->old_dbs[dbs_idx] = 0;
+	nvmev_dbbuf_update_event(dbs_idx, 0, sq->queue_size);
 
 	__make_cq_entry(eid, NVME_SC_SUCCESS);
 }
@@ -187,7 +191,9 @@ static void __nvmev_admin_delete_sq(int eid)
 	qid = cmd->qid;
 
 	sq = nvmev_vdev->sqes[qid];
-	nvmev_vdev->sqes[qid] = NULL;
+	WRITE_ONCE(nvmev_vdev->sqes[qid], NULL);
+	/* Let the other dispatchers finish a round that may still see @sq */
+	nvmev_sync_dispatchers();
 
 	if (sq) {
 		kfree(sq->sq);
@@ -199,6 +205,59 @@ static void __nvmev_admin_delete_sq(int eid)
 	__make_cq_entry(eid, NVME_SC_SUCCESS);
 }
 
+/*
+ * Keep EventIdx one entry behind what the dispatcher has consumed. The host
+ * rings the BAR doorbell only when its update crosses EventIdx, which then
+ * never happens since the dispatchers poll the shadow doorbells anyway.
+ */
+void nvmev_dbbuf_update_event(int dbs_idx, int db, int queue_size)
+{
+	u32 *eis = READ_ONCE(nvmev_vdev->dbbuf_eis);
+
+	if (!eis)
+		return;
+
+	WRITE_ONCE(eis[dbs_idx], (db == 0 ? queue_size : db) - 1);
+}
+
+/*
+ * Doorbell Buffer Config: PRP1 is the page the host writes shadow doorbells
+ * to, PRP2 is the EventIdx page. Both are laid out like the BAR doorbells.
+ * Linux does not shadow the admin queue, so it keeps using the BAR.
+ */
+static void __nvmev_admin_dbbuf_config(int eid)
+{
+	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
+	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
+	struct nvme_common_command *cmd = &sq_entry(eid).common;
+	u64 dbs_addr = cmd->prp1;
+	u64 eis_addr = cmd->prp2;
+	unsigned int qid;
+
+	if (!dbs_addr || !eis_addr || (dbs_addr & ~PAGE_MASK) || (eis_addr & ~PAGE_MASK) ||
+	    !pfn_valid(dbs_addr >> PAGE_SHIFT) || !pfn_valid(eis_addr >> PAGE_SHIFT)) {
+		NVMEV_ERROR("Invalid doorbell buffer 0x%llx 0x%llx\n", dbs_addr, eis_addr);
+		__make_cq_entry(eid, NVME_SC_INVALID_FIELD);
+		return;
+	}
+
+	WRITE_ONCE(nvmev_vdev->dbbuf_eis, prp_address(eis_addr));
+	for (qid = 1; qid <= NR_MAX_IO_QUEUE; qid++) {
+		if (nvmev_vdev->sqes[qid])
+			nvmev_dbbuf_update_event(qid * 2, nvmev_vdev->old_dbs[qid * 2],
+						 nvmev_vdev->sqes[qid]->queue_size);
+		if (nvmev_vdev->cqes[qid])
+			nvmev_dbbuf_update_event(qid * 2 + 1, nvmev_vdev->old_dbs[qid * 2 + 1],
+						 nvmev_vdev->cqes[qid]->queue_size);
+	}
+
+	/* Dispatchers switch over to the shadow doorbells once EventIdx is in place */
+	smp_store_release(&nvmev_vdev->dbbuf_dbs, (u32 *)prp_address(dbs_addr));
+
+	NVMEV_INFO("Doorbell buffer at 0x%llx, EventIdx at 0x%llx\n", dbs_addr, eis_addr);
+	__make_cq_entry(eid, NVME_SC_SUCCESS);
+}
+
 
 /***
  * Log pages
@@ -237,6 +296,8 @@ static void __nvmev_admin_get_log_page(int eid)
 				[nvme_admin_set_features] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
 				[nvme_admin_get_features] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
 				[nvme_admin_async_event] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
+				[nvme_admin_directive_send] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
+				[nvme_admin_directive_recv] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
 				// [nvme_admin_keep_alive] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
 			},
 			.iocs = {
@@ -336,6 +397,12 @@ static void __nvmev_admin_identify_namespace(int eid)
 	ns->ncap = ns->nsze;
 	ns->nuse = ns->nsze;
 
+	if (NS_SSD_TYPE(nsid) == SSD_TYPE_CONV || NS_SSD_TYPE(nsid) == SSD_TYPE_ZNS) {
+		ns->mssrl = NVMEV_MSSRL;
+		ns->mcl = NVMEV_MCL;
+		ns->msrc = NVMEV_MSRC;
+	}
+
 	__make_cq_entry(eid, NVME_SC_SUCCESS);
 }
 
@@ -451,7 +518,17 @@ static void __nvmev_admin_identify_ctrl(int eid)
 	memset(ctrl, 0x00, sizeof(*ctrl));
 
 	ctrl->nn = nvmev_vdev->nr_ns;
+	ctrl->oacs = NVME_CTRL_OACS_DBBUF_SUPP;
+	if (NS_SSD_TYPE(0) == SSD_TYPE_CONV)
+		ctrl->oacs |= NVME_CTRL_OACS_DIRECTIVES;
+	ctrl->sgls = NVME_CTRL_SGLS_BYTE_ALIGNED;
 	ctrl->oncs = 0; //optional command
+	if (NS_SSD_TYPE(0) == SSD_TYPE_CONV)
+		ctrl->oncs |= NVME_CTRL_ONCS_DSM;
+	if (NS_SSD_TYPE(0) != SSD_TYPE_KV)
+		ctrl->oncs |= NVME_CTRL_ONCS_WRITE_ZEROES;
+	if (NS_SSD_TYPE(0) == SSD_TYPE_CONV || NS_SSD_TYPE(0) == SSD_TYPE_ZNS)
+		ctrl->oncs |= NVME_CTRL_ONCS_COPY;
 	ctrl->acl = 3; //minimum 4 required, 0's based value
 	ctrl->vwc = 0;
 	snprintf(ctrl->sn, sizeof(ctrl->sn), "CSL_Virt_SN_%02d", 1);
@@ -506,6 +583,7 @@ static void __nvmev_admin_set_features(int eid)
 	struct nvme_features *cmd = &sq_entry(eid).features;
 	__le32 result0 = 0;
 	__le32 result1 = 0;
+	u16 status = NVME_SC_SUCCESS;
 
 	switch (cmd->fid) {
 	case NVME_FEAT_ARBITRATION:
@@ -515,6 +593,24 @@ static void __nvmev_admin_set_features(int eid)
 	case NVME_FEAT_ERR_RECOVERY:
 	case NVME_FEAT_VOLATILE_WC:
 		break;
+	case NVME_FEAT_IRQ_COALESCE:
+		nvmev_vdev->irq_aggr_thr = cmd->dword11 & 0xFF;
+		nvmev_vdev->irq_aggr_time = (cmd->dword11 >> 8) & 0xFF;
+		break;
+	case NVME_FEAT_IRQ_CONFIG: {
+		unsigned int iv = cmd->dword11 & 0xFFFF;
+
+		if (iv > NR_MAX_IO_QUEUE) {
+			status = NVME_SC_INVALID_FIELD;
+			break;
+		}
+
+		if (cmd->dword11 & (1 << 16)) /* Coalescing Disable */
+			set_bit(iv, nvmev_vdev->irq_coalesce_disabled);
+		else
+			clear_bit(iv, nvmev_vdev->irq_coalesce_disabled);
+		break;
+	}
 	case NVME_FEAT_NUM_QUEUES: {
 		int num_queue;
 
@@ -529,8 +625,6 @@ static void __nvmev_admin_set_features(int eid)
 		result0 = ((nvmev_vdev->nr_cq - 1) << 16 | (nvmev_vdev->nr_sq - 1));
 		break;
 	}
-	case NVME_FEAT_IRQ_COALESCE:
-	case NVME_FEAT_IRQ_CONFIG:
 	case NVME_FEAT_WRITE_ATOMIC:
 	case NVME_FEAT_ASYNC_EVENT:
 	case NVME_FEAT_AUTO_PST:
@@ -542,7 +636,7 @@ static void __nvmev_admin_set_features(int eid)
 		break;
 	}
 
-	__make_cq_entry_results(eid, NVME_SC_SUCCESS, result0, result1);
+	__make_cq_entry_results(eid, status, result0, result1);
 }
 
 static void __nvmev_admin_get_features(int eid)
@@ -552,6 +646,7 @@ static void __nvmev_admin_get_features(int eid)
 	struct nvme_features *cmd = &sq_entry(eid).features;
 	__le32 result0 = 0;
 	__le32 result1 = 0;
+	u16 status = NVME_SC_SUCCESS;
 
 	switch (cmd->fid) {
 	case NVME_FEAT_ARBITRATION:
@@ -565,7 +660,21 @@ static void __nvmev_admin_get_features(int eid)
 		result0 = ((nvmev_vdev->nr_cq - 1) << 16 | (nvmev_vdev->nr_sq - 1));
 		break;
 	case NVME_FEAT_IRQ_COALESCE:
-	case NVME_FEAT_IRQ_CONFIG:
+		result0 = (nvmev_vdev->irq_aggr_time << 8) | nvmev_vdev->irq_aggr_thr;
+		break;
+	case NVME_FEAT_IRQ_CONFIG: {
+		unsigned int iv = cmd->dword11 & 0xFFFF;
+
+		if (iv > NR_MAX_IO_QUEUE) {
+			status = NVME_SC_INVALID_FIELD;
+			break;
+		}
+
+		result0 = iv;
+		if (test_bit(iv, nvmev_vdev->irq_coalesce_disabled))
+			result0 |= (1 << 16);
+		break;
+	}
 	case NVME_FEAT_WRITE_ATOMIC:
 	case NVME_FEAT_ASYNC_EVENT:
 	case NVME_FEAT_AUTO_PST:
@@ -577,10 +686,100 @@ static void __nvmev_admin_get_features(int eid)
 		break;
 	}
 
-	__make_cq_entry_results(eid, NVME_SC_SUCCESS, result0, result1);
+	__make_cq_entry_results(eid, status, result0, result1);
 }
 
 
+/***
+ * Directives
+ */
+static struct nvmev_ns *__directive_ns(struct nvme_directive_cmd *cmd)
+{
+	if (cmd->nsid == 0 || cmd->nsid > nvmev_vdev->nr_ns ||
+	    NS_SSD_TYPE(cmd->nsid - 1) != SSD_TYPE_CONV)
+		return NULL;
+
+	return &nvmev_vdev->ns[cmd->nsid - 1];
+}
+
+static void __nvmev_admin_directive_send(int eid)
+{
+	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
+	struct nvme_directive_cmd *cmd = &sq_entry(eid).directive;
+	struct nvmev_ns *ns = __directive_ns(cmd);
+
+	if (!ns) {
+		__make_cq_entry(eid, NVME_SC_INVALID_NS);
+		return;
+	}
+
+	if (cmd->dtype == NVME_DIR_IDENTIFY && cmd->doper == NVME_DIR_SND_ID_OP_ENABLE &&
+	    cmd->tdtype == NVME_DIR_STREAMS) {
+		WRITE_ONCE(ns->streams_enabled, !!(cmd->endir & NVME_DIR_ENDIR));
+	} else if (cmd->dtype == NVME_DIR_STREAMS && cmd->doper == NVME_DIR_SND_ST_OP_REL_ID) {
+		/* Stream identifiers share write pointers; nothing is held per identifier */
+	} else if (cmd->dtype == NVME_DIR_STREAMS && cmd->doper == NVME_DIR_SND_ST_OP_REL_RSC) {
+		ns->nr_streams = 0;
+	} else {
+		__make_cq_entry(eid, NVME_SC_INVALID_FIELD);
+		return;
+	}
+
+	__make_cq_entry(eid, NVME_SC_SUCCESS);
+}
+
+static void __nvmev_admin_directive_recv(int eid)
+{
+	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
+	struct nvme_directive_cmd *cmd = &sq_entry(eid).directive;
+	struct nvmev_ns *ns = __directive_ns(cmd);
+	size_t len = min_t(size_t, (cmd->numd + 1) * sizeof(u32), PAGE_SIZE);
+	u32 result0 = 0;
+	void *buf;
+
+	if (!ns) {
+		__make_cq_entry(eid, NVME_SC_INVALID_NS);
+		return;
+	}
+
+	buf = prp_address(cmd->prp1);
+	memset(buf, 0, len);
+
+	if (cmd->dtype == NVME_DIR_IDENTIFY && cmd->doper == NVME_DIR_RCV_ID_OP_PARAM) {
+		u8 params[64] = {};
+
+		/* Supported directive types, then enabled ones */
+		params[0] = (1 << NVME_DIR_IDENTIFY) | (1 << NVME_DIR_STREAMS);
+		params[32] = (1 << NVME_DIR_IDENTIFY) |
+			     (READ_ONCE(ns->streams_enabled) << NVME_DIR_STREAMS);
+		memcpy(buf, params, min(len, sizeof(params)));
+	} else if (cmd->dtype == NVME_DIR_STREAMS && cmd->doper == NVME_DIR_RCV_ST_OP_PARAM) {
+		struct conv_ftl *conv_ftl = &((struct conv_ftl *)ns->ftls)[0];
+		struct ssdparams *spp = &conv_ftl->ssd->sp;
+		struct streams_directive_params params = {
+			.msl = NR_STREAMS,
+			.nssa = NR_STREAMS - ns->nr_streams,
+			/* A stream is written a wordline at a time, and a line is freed at once */
+			.sws = BYTE_TO_LBA(spp->pgsz * spp->pgs_per_oneshotpg),
+			.sgs = spp->pgs_per_line / spp->pgs_per_oneshotpg,
+			.nsa = ns->nr_streams,
+		};
+
+		memcpy(buf, &params, min(len, sizeof(params)));
+	} else if (cmd->dtype == NVME_DIR_STREAMS && cmd->doper == NVME_DIR_RCV_ST_OP_STATUS) {
+		/* Open streams are not tracked, so report none (first u16 is the count) */
+	} else if (cmd->dtype == NVME_DIR_STREAMS && cmd->doper == NVME_DIR_RCV_ST_OP_RESOURCE) {
+		/* NSR is the low half of CDW12, where endir and tdtype sit for other operations */
+		ns->nr_streams = min_t(u32, (cmd->tdtype << 8) | cmd->endir, NR_STREAMS);
+		result0 = ns->nr_streams;
+	} else {
+		__make_cq_entry(eid, NVME_SC_INVALID_FIELD);
+		return;
+	}
+
+	__make_cq_entry_results(eid, NVME_SC_SUCCESS, result0, 0);
+}
+
 /***
  * Misc
  */
@@ -631,6 +830,15 @@ static void __nvmev_proc_admin_req(int entry_id)
 	case nvme_admin_async_event:
 		__nvmev_admin_async_event(entry_id);
 		break;
+	case nvme_admin_dbbuf:
+		__nvmev_admin_dbbuf_config(entry_id);
+		break;
+	case nvme_admin_directive_send:
+		__nvmev_admin_directive_send(entry_id);
+		break;
+	case nvme_admin_directive_recv:
+		__nvmev_admin_directive_recv(entry_id);
+		break;
 	case nvme_admin_activate_fw:
 	case nvme_admin_download_fw:
 	case nvme_admin_format_nvm:
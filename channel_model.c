@@ -10,13 +10,11 @@
 
 static inline unsigned long long __get_wallclock(void)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return cpu_clock(nvmev_vdev->config.cpu_nr_dispatcher);
 }
 
 void chmodel_init(struct channel_model *ch, uint64_t bandwidth /*MB/s*/)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	ch->head = 0;
 	ch->valid_len = 0;
 	ch->cur_time = 0;
@@ -32,7 +30,6 @@ void chmodel_init(struct channel_model *ch, uint64_t bandwidth /*MB/s*/)
 
 uint64_t chmodel_request(struct channel_model *ch, uint64_t request_time, uint64_t length)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	uint64_t cur_time = __get_wallclock();
 	uint32_t pos, next_pos;
 	uint32_t remaining_credits, consumed_credits;
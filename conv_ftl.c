@@ -1,46 +1,77 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <linux/hash.h>
+#include <linux/kthread.h>
 #include <linux/ktime.h>
+#include <linux/log2.h>
 #include <linux/sched/clock.h>
 
 #include "nvmev.h"
 #include "conv_ftl.h"
+#include "nvmev_trace.h"
 
 static inline bool last_pg_in_wordline(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	return (ppa->g.pg % spp->pgs_per_oneshotpg) == (spp->pgs_per_oneshotpg - 1);
 }
 
 static bool should_gc(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return (conv_ftl->lm.free_line_cnt <= conv_ftl->cp.gc_thres_lines);
 }
 
 static inline bool should_gc_high(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return conv_ftl->lm.free_line_cnt <= conv_ftl->cp.gc_thres_lines_high;
 }
 
+static inline uint32_t ppa_to_map_ent(struct conv_ftl *conv_ftl, struct ppa *ppa)
+{
+	struct map_fmt *fmt = &conv_ftl->map_fmt;
+
+	if (ppa->ppa == UNMAPPED_PPA)
+		return UNMAPPED_ENT;
+
+	return ppa->g.pg | (ppa->g.blk << fmt->blk_shift) | (ppa->g.pl << fmt->pl_shift) |
+	       (ppa->g.lun << fmt->lun_shift) | (ppa->g.ch << fmt->ch_shift);
+}
+
+static inline struct ppa map_ent_to_ppa(struct conv_ftl *conv_ftl, uint32_t ent)
+{
+	struct map_fmt *fmt = &conv_ftl->map_fmt;
+	struct ppa ppa;
+
+	if (ent == UNMAPPED_ENT) {
+		ppa.ppa = UNMAPPED_PPA;
+		return ppa;
+	}
+
+	ppa.ppa = 0;
+	ppa.g.pg = ent & ((1U << fmt->blk_shift) - 1);
+	ppa.g.blk = (ent >> fmt->blk_shift) & ((1U << (fmt->pl_shift - fmt->blk_shift)) - 1);
+	ppa.g.pl = (ent >> fmt->pl_shift) & ((1U << (fmt->lun_shift - fmt->pl_shift)) - 1);
+	ppa.g.lun = (ent >> fmt->lun_shift) & ((1U << (fmt->ch_shift - fmt->lun_shift)) - 1);
+	ppa.g.ch = (u64)ent >> fmt->ch_shift;
+
+	return ppa;
+}
+
 static inline struct ppa get_maptbl_ent(struct conv_ftl *conv_ftl, uint64_t lpn)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	return conv_ftl->maptbl[lpn];
+	return map_ent_to_ppa(conv_ftl, conv_ftl->maptbl[lpn]);
 }
 
 static inline void set_maptbl_ent(struct conv_ftl *conv_ftl, uint64_t lpn, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	NVMEV_ASSERT(lpn < conv_ftl->ssd->sp.tt_pgs);
-	conv_ftl->maptbl[lpn] = *ppa;
+	conv_ftl->maptbl[lpn] = ppa_to_map_ent(conv_ftl, ppa);
+
+	trace_nvmev_ftl_map(lpn, ppa->g.ch, ppa->g.lun, ppa->g.blk, ppa->g.pg);
 }
 
 static uint64_t ppa2pgidx(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	uint64_t pgidx;
 
@@ -57,75 +88,87 @@ static uint64_t ppa2pgidx(struct conv_ftl *conv_ftl, struct ppa *ppa)
 
 static inline uint64_t get_rmap_ent(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	uint64_t pgidx = ppa2pgidx(conv_ftl, ppa);
+	uint32_t lpn = conv_ftl->rmap[pgidx];
 
-	return conv_ftl->rmap[pgidx];
+	return lpn == UNMAPPED_ENT ? INVALID_LPN : lpn;
 }
 
 /* set rmap[page_no(ppa)] -> lpn */
 static inline void set_rmap_ent(struct conv_ftl *conv_ftl, uint64_t lpn, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	uint64_t pgidx = ppa2pgidx(conv_ftl, ppa);
 
-	conv_ftl->rmap[pgidx] = lpn;
+	NVMEV_ASSERT(lpn == INVALID_LPN || lpn < UNMAPPED_ENT);
+	conv_ftl->rmap[pgidx] = lpn == INVALID_LPN ? UNMAPPED_ENT : lpn;
 }
 
 static inline int victim_line_cmp_pri(pqueue_pri_t next, pqueue_pri_t curr)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return (next > curr);
 }
 
 static inline pqueue_pri_t victim_line_get_pri(void *a)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return ((struct line *)a)->vpc;
 }
 
 static inline void victim_line_set_pri(void *a, pqueue_pri_t pri)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	((struct line *)a)->vpc = pri;
 }
 
 static inline size_t victim_line_get_pos(void *a)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return ((struct line *)a)->pos;
 }
 
 static inline void victim_line_set_pos(void *a, size_t pos)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	((struct line *)a)->pos = pos;
 }
 
+/* Least erased first, then by id */
+static inline pqueue_pri_t free_line_get_pri(void *a)
+{
+	struct line *line = a;
+
+	return ((pqueue_pri_t)line->erase_cnt << 32) | line->id;
+}
+
+static inline void free_line_set_pri(void *a, pqueue_pri_t pri)
+{
+	((struct line *)a)->erase_cnt = pri >> 32;
+}
+
 static inline void consume_write_credit(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	conv_ftl->wfc.write_credits--;
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
-static void foreground_gc(struct conv_ftl *conv_ftl);
+/* Have the GC thread of the partition look for work */
+static inline void conv_gc_kick(struct conv_ftl *conv_ftl)
+{
+	if (!conv_ftl->gc_thread || READ_ONCE(conv_ftl->gc_wanted))
+		return;
+
+	WRITE_ONCE(conv_ftl->gc_wanted, true);
+	wake_up_interruptible(&conv_ftl->gc_wq);
+}
 
 static inline void check_and_refill_write_credit(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct write_flow_control *wfc = &(conv_ftl->wfc);
 	if (wfc->write_credits <= 0) {
-		foreground_gc(conv_ftl);
+		if (should_gc_high(conv_ftl))
+			conv_gc_kick(conv_ftl);
 
 		wfc->write_credits += wfc->credits_to_refill;
 	}
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static void init_lines(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct line_mgmt *lm = &conv_ftl->lm;
 	struct line *line;
@@ -135,96 +178,95 @@ static void init_lines(struct conv_ftl *conv_ftl)
 	NVMEV_ASSERT(lm->tt_lines == spp->tt_lines);
 	lm->lines = vmalloc(sizeof(struct line) * lm->tt_lines);
 
-	INIT_LIST_HEAD(&lm->free_line_list);
 	INIT_LIST_HEAD(&lm->full_line_list);
 
+	lm->free_line_pq = pqueue_init(spp->tt_lines, victim_line_cmp_pri, free_line_get_pri,
+				       free_line_set_pri, victim_line_get_pos,
+				       victim_line_set_pos);
+
 	lm->victim_line_pq = pqueue_init(spp->tt_lines, victim_line_cmp_pri, victim_line_get_pri,
 					 victim_line_set_pri, victim_line_get_pos,
 					 victim_line_set_pos);
 
 	lm->free_line_cnt = 0;
+	lm->reserved_line_cnt = 0;
 	for (i = 0; i < lm->tt_lines; i++) {
 		lm->lines[i] = (struct line){
 			.id = i,
 			.ipc = 0,
 			.vpc = 0,
 			.pos = 0,
+			.seq = 0,
+			.erase_cnt = 0,
 			.entry = LIST_HEAD_INIT(lm->lines[i].entry),
 		};
 
 		/* initialize all the lines as free lines */
-		list_add_tail(&lm->lines[i].entry, &lm->free_line_list);
+		pqueue_insert(lm->free_line_pq, &lm->lines[i]);
 		lm->free_line_cnt++;
 	}
 
 	NVMEV_ASSERT(lm->free_line_cnt == lm->tt_lines);
 	lm->victim_line_cnt = 0;
 	lm->full_line_cnt = 0;
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
+	lm->nr_filled = 0;
+	lm->max_erase_cnt = 0;
 }
 
 static void remove_lines(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
+	pqueue_free(conv_ftl->lm.free_line_pq);
 	pqueue_free(conv_ftl->lm.victim_line_pq);
 	vfree(conv_ftl->lm.lines);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static void init_write_flow_control(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct write_flow_control *wfc = &(conv_ftl->wfc);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 
 	wfc->write_credits = spp->pgs_per_line;//64 1个line有4个block,1个block有16个page
 	wfc->credits_to_refill = spp->pgs_per_line;//64
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static inline void check_addr(int a, int max)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	NVMEV_ASSERT(a >= 0 && a < max);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static struct line *get_next_free_line(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct line_mgmt *lm = &conv_ftl->lm;
-	struct line *curline = list_first_entry_or_null(&lm->free_line_list, struct line, entry);
+	struct line *curline = pqueue_pop(lm->free_line_pq);
 
 	if (!curline) {
 		NVMEV_ERROR("No free line left in VIRT !!!!\n");
 		return NULL;
 	}
 
-	list_del_init(&curline->entry);
+	/* pos tells victim lines apart from now on */
+	curline->pos = 0;
 	lm->free_line_cnt--;
 	NVMEV_DEBUG("%s: free_line_cnt %d\n", __func__, lm->free_line_cnt);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return curline;
 }
 
-static struct write_pointer *__get_wp(struct conv_ftl *ftl, uint32_t io_type)
+/* @wp_id picks one of the write pointers for host data, WP_* */
+static struct write_pointer *__get_wp(struct conv_ftl *ftl, uint32_t io_type, uint32_t wp_id)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	if (io_type == USER_IO) {
-		return &ftl->wp;
+		NVMEV_ASSERT(wp_id < NR_WPS);
+		return &ftl->wp[wp_id];
 	} else if (io_type == GC_IO) {
 		return &ftl->gc_wp;
 	}
 
 	NVMEV_ASSERT(0);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return NULL;
 }
 
-static void prepare_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
+static void prepare_write_pointer(struct conv_ftl *conv_ftl, struct write_pointer *wp)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct write_pointer *wp = __get_wp(conv_ftl, io_type);
 	struct line *curline = get_next_free_line(conv_ftl);
 
 	NVMEV_ASSERT(wp);
@@ -239,15 +281,13 @@ static void prepare_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
 		.blk = curline->id,
 		.pl = 0,
 	};
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
+	INIT_LIST_HEAD(&wp->wc_pending);
 }
 
-static void advance_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
+static void advance_write_pointer(struct conv_ftl *conv_ftl, struct write_pointer *wpp)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct line_mgmt *lm = &conv_ftl->lm;
-	struct write_pointer *wpp = __get_wp(conv_ftl, io_type);
 
 	NVMEV_DEBUG_VERBOSE("current wpp: ch:%d, lun:%d, pl:%d, blk:%d, pg:%d\n",
 			wpp->ch, wpp->lun, wpp->pl, wpp->blk, wpp->pg);
@@ -277,6 +317,7 @@ static void advance_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
 		goto out;
 
 	wpp->pg = 0;
+	wpp->curline->seq = ++lm->nr_filled;
 	/* move current line to {victim,full} line list */
 	if (wpp->curline->vpc == spp->pgs_per_line) {
 		/* all pgs are still valid, move to full line list */
@@ -292,8 +333,16 @@ static void advance_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
 		pqueue_insert(lm->victim_line_pq, wpp->curline);
 		lm->victim_line_cnt++;
 	}
-	/* current line is used up, pick another empty line */
+	/*
+	 * current line is used up. Host write pointers open their next line
+	 * when data come, so that padding never takes a free line; GC needs
+	 * its line right away.
+	 */
 	check_addr(wpp->blk, spp->blks_per_pl);
+	if (wpp != &conv_ftl->gc_wp) {
+		wpp->curline = NULL;
+		return;
+	}
 	wpp->curline = get_next_free_line(conv_ftl);
 	NVMEV_DEBUG_VERBOSE("wpp: got new clean line %d\n", wpp->curline->id);
 
@@ -309,14 +358,11 @@ static void advance_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
 out:
 	NVMEV_DEBUG_VERBOSE("advanced wpp: ch:%d, lun:%d, pl:%d, blk:%d, pg:%d (curline %d)\n",
 			wpp->ch, wpp->lun, wpp->pl, wpp->blk, wpp->pg, wpp->curline->id);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
-static struct ppa get_new_page(struct conv_ftl *conv_ftl, uint32_t io_type)
+static struct ppa get_new_page(struct conv_ftl *conv_ftl, struct write_pointer *wp)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ppa ppa;
-	struct write_pointer *wp = __get_wp(conv_ftl, io_type);
 
 	ppa.ppa = 0;
 	ppa.g.ch = wp->ch;
@@ -327,60 +373,290 @@ static struct ppa get_new_page(struct conv_ftl *conv_ftl, uint32_t io_type)
 
 	NVMEV_ASSERT(ppa.g.pl == 0);
 
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return ppa;
 }
 
+/* Pack each ppa field into as many bits as the geometry needs */
+static void init_map_fmt(struct conv_ftl *conv_ftl)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct map_fmt *fmt = &conv_ftl->map_fmt;
+
+	fmt->blk_shift = order_base_2(spp->pgs_per_blk);
+	fmt->pl_shift = fmt->blk_shift + order_base_2(spp->blks_per_pl);
+	fmt->lun_shift = fmt->pl_shift + order_base_2(spp->pls_per_lun);
+	fmt->ch_shift = fmt->lun_shift + order_base_2(spp->luns_per_ch);
+	fmt->nr_bits = fmt->ch_shift + order_base_2(spp->nchs);
+
+	/* All ones is left for UNMAPPED_ENT */
+	if (fmt->nr_bits >= 32) {
+		NVMEV_ERROR("%s: ppa needs %u bits\n", __func__, fmt->nr_bits);
+		NVMEV_ASSERT(0);
+	}
+}
+
 static void init_maptbl(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	int i;
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 
-	conv_ftl->maptbl = vmalloc(sizeof(struct ppa) * spp->tt_pgs);//一个分区有 524288个页
+	init_map_fmt(conv_ftl);
+
+	conv_ftl->maptbl = vmalloc(sizeof(uint32_t) * spp->tt_pgs);//一个分区有 524288个页
 	for (i = 0; i < spp->tt_pgs; i++) {
-		conv_ftl->maptbl[i].ppa = UNMAPPED_PPA;// 物理地址初始化为ffff,ffff,ffff,ffff
+		conv_ftl->maptbl[i] = UNMAPPED_ENT;
 	}
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static void remove_maptbl(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	vfree(conv_ftl->maptbl);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
+}
+
+static void init_cmt(struct conv_ftl *conv_ftl)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct cmt *cmt = &conv_ftl->cmt;
+	uint64_t size = DFTL_CMT_SIZE / SSD_PARTITIONS;
+	uint32_t i;
+
+	memset(cmt, 0, sizeof(*cmt));
+	cmt->ents_per_tpage = spp->pgsz / sizeof(uint32_t);
+	cmt->nr_tpages = DIV_ROUND_UP(spp->tt_pgs, cmt->ents_per_tpage);
+
+	if (size == 0 || size / spp->pgsz >= cmt->nr_tpages)
+		return;
+
+	cmt->nr_slots = max_t(uint64_t, size / spp->pgsz, 1);
+	cmt->slots = vmalloc(sizeof(struct cmt_slot) * cmt->nr_slots);
+	cmt->tpage_slot = vmalloc(sizeof(uint32_t) * cmt->nr_tpages);
+	for (i = 0; i < cmt->nr_tpages; i++) {
+		cmt->tpage_slot[i] = CMT_NONE;
+	}
+
+	NVMEV_INFO("DFTL: caching %u of %u translation pages\n", cmt->nr_slots, cmt->nr_tpages);
+}
+
+static void remove_cmt(struct conv_ftl *conv_ftl)
+{
+	vfree(conv_ftl->cmt.slots);
+	vfree(conv_ftl->cmt.tpage_slot);
+}
+
+/* Translation pages are striped over the LUNs, apart from the user lines */
+static uint64_t tpage_io(struct conv_ftl *conv_ftl, uint32_t tpage, int cmd, int io_type,
+			 uint64_t stime)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct ppa ppa = { .ppa = 0 };
+	struct nand_cmd tcmd = {
+		.type = io_type,
+		.cmd = cmd,
+		.stime = stime,
+		.xfer_size = spp->pgsz,
+		.interleave_pci_dma = false,
+		.ppa = &ppa,
+	};
+
+	ppa.g.ch = tpage % spp->nchs;
+	ppa.g.lun = (tpage / spp->nchs) % spp->luns_per_ch;
+	ppa.g.pg = (tpage / spp->tt_luns) % spp->pgs_per_blk;
+
+	return ssd_advance_nand(conv_ftl->ssd, &tcmd);
+}
+
+/* Free a CMT slot, writing back a dirty translation page by CLOCK */
+static uint32_t cmt_evict(struct conv_ftl *conv_ftl, int io_type, uint64_t stime)
+{
+	struct cmt *cmt = &conv_ftl->cmt;
+	struct cmt_slot *slot;
+
+	if (cmt->nr_used < cmt->nr_slots)
+		return cmt->nr_used++;
+
+	while (true) {
+		slot = &cmt->slots[cmt->hand];
+		cmt->hand = (cmt->hand + 1) % cmt->nr_slots;
+		if (!slot->ref)
+			break;
+		slot->ref = false;
+	}
+
+	if (slot->dirty) {
+		tpage_io(conv_ftl, slot->tpage, NAND_WRITE, io_type, stime);
+		cmt->writebacks++;
+	}
+	cmt->tpage_slot[slot->tpage] = CMT_NONE;
+
+	return slot - cmt->slots;
+}
+
+/*
+ * Look up the mappings of local LPNs [@slpn, @elpn] in the CMT, dirtying them
+ * if @dirty. Returns when they are available, which is @stime unless a
+ * translation page has to be read from NAND.
+ */
+static uint64_t cmt_fetch(struct conv_ftl *conv_ftl, uint64_t slpn, uint64_t elpn, bool dirty,
+			  int io_type, uint64_t stime)
+{
+	struct cmt *cmt = &conv_ftl->cmt;
+	uint64_t nsecs_ready = stime;
+	uint32_t tpage, slot;
+
+	if (cmt->nr_slots == 0)
+		return stime;
+
+	for (tpage = slpn / cmt->ents_per_tpage; tpage <= elpn / cmt->ents_per_tpage; tpage++) {
+		slot = cmt->tpage_slot[tpage];
+		if (slot != CMT_NONE) {
+			cmt->hits++;
+		} else {
+			slot = cmt_evict(conv_ftl, io_type, stime);
+			cmt->slots[slot].tpage = tpage;
+			cmt->slots[slot].dirty = false;
+			cmt->tpage_slot[tpage] = slot;
+			cmt->misses++;
+
+			nsecs_ready = max(tpage_io(conv_ftl, tpage, NAND_READ, io_type, stime),
+					  nsecs_ready);
+		}
+
+		cmt->slots[slot].ref = true;
+		cmt->slots[slot].dirty |= dirty;
+	}
+
+	return nsecs_ready;
+}
+
+static void init_wcache(struct conv_ftl *conv_ftl)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct wcache *wc = &conv_ftl->wcache;
+	uint32_t i;
+
+	/* Each partition may hold up to the whole write buffer */
+	wc->nr_slots = max_t(uint64_t, spp->write_buffer_size / spp->pgsz, 1);
+	wc->head = 0;
+	wc->hash_bits = order_base_2(wc->nr_slots);
+	wc->hits = 0;
+
+	wc->slots = vmalloc(sizeof(struct wcache_slot) * wc->nr_slots);
+	for (i = 0; i < wc->nr_slots; i++) {
+		wc->slots[i].lpn = INVALID_LPN;
+		wc->slots[i].nsecs_done = 0;
+		INIT_HLIST_NODE(&wc->slots[i].hnode);
+		INIT_LIST_HEAD(&wc->slots[i].pending);
+	}
+
+	wc->hash = vmalloc(sizeof(struct hlist_head) * (1U << wc->hash_bits));
+	for (i = 0; i < (1U << wc->hash_bits); i++) {
+		INIT_HLIST_HEAD(&wc->hash[i]);
+	}
+}
+
+static void remove_wcache(struct conv_ftl *conv_ftl)
+{
+	vfree(conv_ftl->wcache.hash);
+	vfree(conv_ftl->wcache.slots);
+}
+
+static struct wcache_slot *wcache_lookup(struct conv_ftl *conv_ftl, uint64_t lpn)
+{
+	struct wcache *wc = &conv_ftl->wcache;
+	struct wcache_slot *slot;
+
+	hlist_for_each_entry(slot, &wc->hash[hash_64(lpn, wc->hash_bits)], hnode) {
+		if (slot->lpn == lpn)
+			return slot;
+	}
+
+	return NULL;
+}
+
+static void wcache_drop(struct conv_ftl *conv_ftl, uint64_t lpn)
+{
+	struct wcache_slot *slot = wcache_lookup(conv_ftl, lpn);
+
+	if (slot) {
+		hlist_del_init(&slot->hnode);
+		slot->lpn = INVALID_LPN;
+	}
+}
+
+/* Data of @lpn enter the write buffer, for the wordline being filled by @wpp */
+static void wcache_insert(struct conv_ftl *conv_ftl, uint64_t lpn, struct write_pointer *wpp)
+{
+	struct wcache *wc = &conv_ftl->wcache;
+	struct wcache_slot *slot = &wc->slots[wc->head];
+
+	wc->head = (wc->head + 1) % wc->nr_slots;
+
+	if (slot->lpn != INVALID_LPN)
+		hlist_del_init(&slot->hnode);
+	list_del_init(&slot->pending);
+
+	wcache_drop(conv_ftl, lpn);
+
+	slot->lpn = lpn;
+	slot->nsecs_done = U64_MAX;
+	hlist_add_head(&slot->hnode, &wc->hash[hash_64(lpn, wc->hash_bits)]);
+	list_add_tail(&slot->pending, &wpp->wc_pending);
+}
+
+/* The wordline filled by @wpp is programmed by @nsecs_done */
+static void wcache_program(struct write_pointer *wpp, uint64_t nsecs_done)
+{
+	struct wcache_slot *slot, *tmp;
+
+	list_for_each_entry_safe(slot, tmp, &wpp->wc_pending, pending) {
+		slot->nsecs_done = nsecs_done;
+		list_del_init(&slot->pending);
+	}
+}
+
+/* Whether the data of @lpn are still in the write buffer at @nsecs */
+static bool wcache_hit(struct conv_ftl *conv_ftl, uint64_t lpn, uint64_t nsecs)
+{
+	struct wcache_slot *slot = wcache_lookup(conv_ftl, lpn);
+
+	return slot && slot->nsecs_done > nsecs;
 }
 
 static void init_rmap(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	int i;
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 
-	conv_ftl->rmap = vmalloc(sizeof(uint64_t) * spp->tt_pgs);
+	conv_ftl->rmap = vmalloc(sizeof(uint32_t) * spp->tt_pgs);
 	for (i = 0; i < spp->tt_pgs; i++) {
-		conv_ftl->rmap[i] = INVALID_LPN;// 初始化为ffff,ffff,ffff,ffff
+		conv_ftl->rmap[i] = UNMAPPED_ENT;
 	}
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static void remove_rmap(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	vfree(conv_ftl->rmap);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static void conv_init_ftl(struct conv_ftl *conv_ftl, struct convparams *cpp, struct ssd *ssd)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
+	int i;
+
 	/*copy convparams*/
 	conv_ftl->cp = *cpp;
 
 	conv_ftl->ssd = ssd;
 
+	spin_lock_init(&conv_ftl->lock);
+	init_waitqueue_head(&conv_ftl->gc_wq);
+	conv_ftl->gc_wanted = false;
+	conv_ftl->gc_thread = NULL;
+	conv_ftl->gc_room = 0;
+
 	/* initialize maptbl */
 	init_maptbl(conv_ftl); // mapping table 按页映射ppa(物理页地址)physical page address
+	init_cmt(conv_ftl);
+	init_wcache(conv_ftl);
 
 	/* initialize rmap */
 	init_rmap(conv_ftl); // reverse mapping table 反向映射表,存放物理地址对应的逻辑页号LPN(Logical page number)
@@ -389,42 +665,56 @@ static void conv_init_ftl(struct conv_ftl *conv_ftl, struct convparams *cpp, str
 	init_lines(conv_ftl);
 
 	/* initialize write pointer, this is how we allocate new pages for writes */
-	prepare_write_pointer(conv_ftl, USER_IO);
-	prepare_write_pointer(conv_ftl, GC_IO);
+	for (i = 0; i < NR_WPS; i++) {
+		conv_ftl->wp[i].curline = NULL;
+		INIT_LIST_HEAD(&conv_ftl->wp[i].wc_pending);
+	}
+	INIT_LIST_HEAD(&conv_ftl->gc_wp.wc_pending);
+	prepare_write_pointer(conv_ftl, __get_wp(conv_ftl, USER_IO, WP_DEFAULT));
+	prepare_write_pointer(conv_ftl, __get_wp(conv_ftl, GC_IO, 0));
 
 	init_write_flow_control(conv_ftl);//流量控制
 
+	conv_ftl->nr_fg_gc = 0;
+	conv_ftl->nr_bg_gc = 0;
+	conv_ftl->nr_wl = 0;
+	conv_ftl->wl_pgs = 0;
+	memset(conv_ftl->gc_stat, 0, sizeof(conv_ftl->gc_stat));
+	conv_ftl->gc_rand = 2463534242U;
+
 	NVMEV_INFO("Init FTL instance with %d channels (%ld pages)\n", conv_ftl->ssd->sp.nchs,
 		   conv_ftl->ssd->sp.tt_pgs);
 
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return;
 }
 
 static void conv_remove_ftl(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	remove_lines(conv_ftl);
 	remove_rmap(conv_ftl);
+	remove_cmt(conv_ftl);
+	remove_wcache(conv_ftl);
 	remove_maptbl(conv_ftl);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 //设置垃圾回收参数
 static void conv_init_params(struct convparams *cpp)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	cpp->op_area_pcent = OP_AREA_PERCENT;// samsung 0.07
 	cpp->gc_thres_lines = 2; /* Need only two lines.(host write, gc)*/
 	cpp->gc_thres_lines_high = 2; /* Need only two lines.(host write, gc)*/
+	cpp->bg_gc_thres_lines = 8;
+	cpp->gc_policy = GC_POLICY_GREEDY;
+	cpp->hot_thres_lines = 0;
+	cpp->wl_thres_erases = 64;
 	cpp->enable_gc_delay = 1;
 	cpp->pba_pcent = (int)((1 + cpp->op_area_pcent) * 100);// 107
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
+static int conv_gc_thread(void *data);
+
 void conv_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *mapped_addr,
 			 uint32_t cpu_nr_dispatcher)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams spp;
 	struct convparams cpp;
 	struct conv_ftl *conv_ftls;
@@ -465,17 +755,29 @@ void conv_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *
 	ns->mapped = mapped_addr;
 	/*register io command handler*/
 	ns->proc_io_cmd = conv_proc_nvme_io_cmd;
+	ns->proc_idle = conv_proc_idle;
+
+	for (i = 0; i < nr_parts; i++) {
+		struct task_struct *gc_thread =
+			kthread_run(conv_gc_thread, &conv_ftls[i], "nvmev_gc_%u_%u", id, i);
+
+		/* Without the thread, GC of the partition runs on the dispatcher */
+		if (IS_ERR(gc_thread)) {
+			NVMEV_ERROR("Failed to start the GC thread of partition %u, GC runs inline\n",
+				    i);
+			continue;
+		}
+		conv_ftls[i].gc_thread = gc_thread;
+	}
 
 	NVMEV_INFO("FTL physical space: %lld, logical space: %lld (physical/logical * 100 = %d)\n",
 		   size, ns->size, cpp.pba_pcent);
 
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return;
 }
 
 void conv_remove_namespace(struct nvmev_ns *ns)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
 	const uint32_t nr_parts = SSD_PARTITIONS;
 	uint32_t i;
@@ -490,6 +792,11 @@ void conv_remove_namespace(struct nvmev_ns *ns)
 		conv_ftls[i].ssd->write_buffer = NULL;
 	}
 
+	for (i = 0; i < nr_parts; i++) {
+		if (conv_ftls[i].gc_thread)
+			kthread_stop(conv_ftls[i].gc_thread);
+	}
+
 	for (i = 0; i < nr_parts; i++) {
 		conv_remove_ftl(&conv_ftls[i]);
 		ssd_remove(conv_ftls[i].ssd);
@@ -502,7 +809,6 @@ void conv_remove_namespace(struct nvmev_ns *ns)
 
 static inline bool valid_ppa(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	int ch = ppa->g.ch;
 	int lun = ppa->g.lun;
@@ -522,35 +828,27 @@ static inline bool valid_ppa(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	if (pg < 0 || pg >= spp->pgs_per_blk)
 		return false;
 
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return true;
 }
 
 static inline bool valid_lpn(struct conv_ftl *conv_ftl, uint64_t lpn)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return (lpn < conv_ftl->ssd->sp.tt_pgs);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static inline bool mapped_ppa(struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return !(ppa->ppa == UNMAPPED_PPA);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static inline struct line *get_line(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return &(conv_ftl->lm.lines[ppa->g.blk]);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 /* update SSD status about one page from PG_VALID -> PG_VALID */
 static void mark_page_invalid(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct line_mgmt *lm = &conv_ftl->lm;
 	struct nand_block *blk = NULL;
@@ -573,7 +871,8 @@ static void mark_page_invalid(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	/* update corresponding line status */
 	line = get_line(conv_ftl, ppa);
 	NVMEV_ASSERT(line->ipc >= 0 && line->ipc < spp->pgs_per_line);
-	if (line->vpc == spp->pgs_per_line) {
+	/* Not a line being reclaimed, which is on no list */
+	if (line->vpc == spp->pgs_per_line && !list_empty(&line->entry)) {
 		NVMEV_ASSERT(line->ipc == 0);
 		was_full_line = true;
 	}
@@ -594,12 +893,10 @@ static void mark_page_invalid(struct conv_ftl *conv_ftl, struct ppa *ppa)
 		pqueue_insert(lm->victim_line_pq, line);
 		lm->victim_line_cnt++;
 	}
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static void mark_page_valid(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct nand_block *blk = NULL;
 	struct nand_page *pg = NULL;
@@ -619,12 +916,31 @@ static void mark_page_valid(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	line = get_line(conv_ftl, ppa);
 	NVMEV_ASSERT(line->vpc >= 0 && line->vpc < spp->pgs_per_line);
 	line->vpc++;
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
+}
+
+/* Padding fills up a wordline without data, so it is invalid from the start */
+static void mark_page_padded(struct conv_ftl *conv_ftl, struct ppa *ppa)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct nand_block *blk = NULL;
+	struct nand_page *pg = NULL;
+	struct line *line;
+
+	pg = get_pg(conv_ftl->ssd, ppa);
+	NVMEV_ASSERT(pg->status == PG_FREE);
+	pg->status = PG_INVALID;
+
+	blk = get_blk(conv_ftl->ssd, ppa);
+	NVMEV_ASSERT(blk->ipc >= 0 && blk->ipc < spp->pgs_per_blk);
+	blk->ipc++;
+
+	line = get_line(conv_ftl, ppa);
+	NVMEV_ASSERT(line->ipc >= 0 && line->ipc < spp->pgs_per_line);
+	line->ipc++;
 }
 
 static void mark_block_free(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct nand_block *blk = get_blk(conv_ftl->ssd, ppa);
 	struct nand_page *pg = NULL;
@@ -642,12 +958,10 @@ static void mark_block_free(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	blk->ipc = 0;
 	blk->vpc = 0;
 	blk->erase_cnt++;
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 static void gc_read_page(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct convparams *cpp = &conv_ftl->cp;
 	/* advance conv_ftl status, we don't care about how long it takes */
@@ -662,20 +976,21 @@ static void gc_read_page(struct conv_ftl *conv_ftl, struct ppa *ppa)
 		};
 		ssd_advance_nand(conv_ftl->ssd, &gcr);
 	}
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 /* move valid page data (already in DRAM) from victim line to a new page */
 static uint64_t gc_write_page(struct conv_ftl *conv_ftl, struct ppa *old_ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct convparams *cpp = &conv_ftl->cp;
+	struct write_pointer *wpp = __get_wp(conv_ftl, GC_IO, 0);
 	struct ppa new_ppa;
 	uint64_t lpn = get_rmap_ent(conv_ftl, old_ppa);
+	uint64_t nsecs_completed;
 
 	NVMEV_ASSERT(valid_lpn(conv_ftl, lpn));
-	new_ppa = get_new_page(conv_ftl, GC_IO);
+	nsecs_completed = cmt_fetch(conv_ftl, lpn, lpn, true, GC_IO, 0);
+	new_ppa = get_new_page(conv_ftl, wpp);
 	/* update maptbl */
 	set_maptbl_ent(conv_ftl, lpn, &new_ppa);
 	/* update rmap */
@@ -684,7 +999,7 @@ static uint64_t gc_write_page(struct conv_ftl *conv_ftl, struct ppa *old_ppa)
 	mark_page_valid(conv_ftl, &new_ppa);
 
 	/* need to advance the write pointer here */
-	advance_write_pointer(conv_ftl, GC_IO);
+	advance_write_pointer(conv_ftl, wpp);
 
 	if (cpp->enable_gc_delay) {
 		struct nand_cmd gcw = {
@@ -699,7 +1014,7 @@ static uint64_t gc_write_page(struct conv_ftl *conv_ftl, struct ppa *old_ppa)
 			gcw.xfer_size = spp->pgsz * spp->pgs_per_oneshotpg;
 		}
 
-		ssd_advance_nand(conv_ftl->ssd, &gcw);
+		nsecs_completed = max(ssd_advance_nand(conv_ftl->ssd, &gcw), nsecs_completed);
 	}
 
 	/* advance per-ch gc_endtime as well */
@@ -711,18 +1026,100 @@ static uint64_t gc_write_page(struct conv_ftl *conv_ftl, struct ppa *old_ppa)
 	new_lun->gc_endtime = new_lun->next_lun_avail_time;
 #endif
 
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
-	return 0;
+	return nsecs_completed;
+}
+
+static struct line *greedy_select(struct conv_ftl *conv_ftl)
+{
+	return pqueue_peek(conv_ftl->lm.victim_line_pq);
+}
+
+static struct line *cost_benefit_select(struct conv_ftl *conv_ftl)
+{
+	struct line_mgmt *lm = &conv_ftl->lm;
+	struct line *victim_line = NULL;
+	uint64_t best = 0;
+	size_t i;
+
+	for (i = 1; i <= pqueue_size(lm->victim_line_pq); i++) {
+		struct line *line = lm->victim_line_pq->d[i];
+		/* (1 - u) / 2u is ipc / 2vpc for a filled-up line */
+		uint64_t score = (lm->nr_filled - line->seq + 1) * line->ipc / (2 * line->vpc + 1);
+
+		if (!victim_line || score > best) {
+			victim_line = line;
+			best = score;
+		}
+	}
+
+	return victim_line;
+}
+
+static struct line *d_choices_select(struct conv_ftl *conv_ftl)
+{
+	struct line_mgmt *lm = &conv_ftl->lm;
+	size_t nr_lines = pqueue_size(lm->victim_line_pq);
+	struct line *victim_line = NULL;
+	int i;
+
+	if (nr_lines == 0)
+		return NULL;
+
+	for (i = 0; i < GC_D_CHOICES; i++) {
+		uint32_t x = conv_ftl->gc_rand;
+		struct line *line;
+
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		conv_ftl->gc_rand = x;
+
+		line = lm->victim_line_pq->d[1 + x % nr_lines];
+		if (!victim_line || line->vpc < victim_line->vpc)
+			victim_line = line;
+	}
+
+	return victim_line;
+}
+
+static struct line *fifo_select(struct conv_ftl *conv_ftl)
+{
+	struct line_mgmt *lm = &conv_ftl->lm;
+	struct line *victim_line = NULL;
+	size_t i;
+
+	for (i = 1; i <= pqueue_size(lm->victim_line_pq); i++) {
+		struct line *line = lm->victim_line_pq->d[i];
+
+		if (!victim_line || line->seq < victim_line->seq)
+			victim_line = line;
+	}
+
+	return victim_line;
+}
+
+static const struct {
+	const char *name;
+	struct line *(*select)(struct conv_ftl *conv_ftl);
+} gc_policies[NR_GC_POLICIES] = {
+	[GC_POLICY_GREEDY] = { "greedy", greedy_select },
+	[GC_POLICY_COST_BENEFIT] = { "cost-benefit", cost_benefit_select },
+	[GC_POLICY_D_CHOICES] = { "d-choices", d_choices_select },
+	[GC_POLICY_FIFO] = { "fifo", fifo_select },
+};
+
+const char *conv_gc_policy_name(uint32_t policy)
+{
+	return policy < NR_GC_POLICIES ? gc_policies[policy].name : NULL;
 }
 
-static struct line *select_victim_line(struct conv_ftl *conv_ftl, bool force)
+static struct line *select_victim_line(struct conv_ftl *conv_ftl, uint32_t policy, bool force)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct line_mgmt *lm = &conv_ftl->lm;
 	struct line *victim_line = NULL;
 
-	victim_line = pqueue_peek(lm->victim_line_pq);
+	victim_line = gc_policies[policy].select(conv_ftl);
 	if (!victim_line) {
 		return NULL;
 	}
@@ -731,19 +1128,17 @@ static struct line *select_victim_line(struct conv_ftl *conv_ftl, bool force)
 		return NULL;
 	}
 
-	pqueue_pop(lm->victim_line_pq);
+	pqueue_remove(lm->victim_line_pq, victim_line);
 	victim_line->pos = 0;
 	lm->victim_line_cnt--;
 
 	/* victim_line is a danggling node now */
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return victim_line;
 }
 
 /* here ppa identifies the block we want to clean */
 static void clean_one_block(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct nand_page *pg_iter = NULL;
 	int cnt = 0;
@@ -763,13 +1158,11 @@ static void clean_one_block(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	}
 
 	NVMEV_ASSERT(get_blk(conv_ftl->ssd, ppa)->vpc == cnt);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
 /* here ppa identifies the block we want to clean */
-static void clean_one_flashpg(struct conv_ftl *conv_ftl, struct ppa *ppa)
+static uint64_t clean_one_flashpg(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct convparams *cpp = &conv_ftl->cp;
 	struct nand_page *pg_iter = NULL;
@@ -790,7 +1183,7 @@ static void clean_one_flashpg(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	ppa_copy = *ppa;
 
 	if (cnt <= 0)
-		return;
+		return 0;
 
 	if (cpp->enable_gc_delay) {
 		struct nand_cmd gcr = {
@@ -810,47 +1203,45 @@ static void clean_one_flashpg(struct conv_ftl *conv_ftl, struct ppa *ppa)
 		/* there shouldn't be any free page in victim blocks */
 		if (pg_iter->status == PG_VALID) {
 			/* delay the maptbl update until "write" happens */
-			gc_write_page(conv_ftl, &ppa_copy);
+			completed_time = max(completed_time, gc_write_page(conv_ftl, &ppa_copy));
 		}
 
 		ppa_copy.g.pg++;
 	}
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
+
+	return completed_time;
 }
 
 static void mark_line_free(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct line_mgmt *lm = &conv_ftl->lm;
 	struct line *line = get_line(conv_ftl, ppa);
 	line->ipc = 0;
 	line->vpc = 0;
+	line->seq = 0;
+	line->erase_cnt = get_blk(conv_ftl->ssd, ppa)->erase_cnt;
+	lm->max_erase_cnt = max(lm->max_erase_cnt, line->erase_cnt);
 	/* move this line to free line list */
-	list_add_tail(&line->entry, &lm->free_line_list);
+	pqueue_insert(lm->free_line_pq, line);
 	lm->free_line_cnt++;
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
-static int do_gc(struct conv_ftl *conv_ftl, bool force)
+/*
+ * Copy the valid pages of @victim_line out and erase its blocks. Returns when
+ * the last of the NAND operations completes.
+ */
+static uint64_t reclaim_line(struct conv_ftl *conv_ftl, struct line *victim_line)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct line *victim_line = NULL;
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	uint64_t nsecs_latest = 0;
 	struct ppa ppa;
 	int flashpg;
 
-	victim_line = select_victim_line(conv_ftl, force);
-	if (!victim_line) {
-		return -1;
-	}
-
 	ppa.g.blk = victim_line->id;
 	NVMEV_DEBUG_VERBOSE("GC-ing line:%d,ipc=%d(%d),victim=%d,full=%d,free=%d\n", ppa.g.blk,
 		    victim_line->ipc, victim_line->vpc, conv_ftl->lm.victim_line_cnt,
 		    conv_ftl->lm.full_line_cnt, conv_ftl->lm.free_line_cnt);
 
-	conv_ftl->wfc.credits_to_refill = victim_line->ipc;
-
 	/* copy back valid data */
 	for (flashpg = 0; flashpg < spp->flashpgs_per_blk; flashpg++) {
 		int ch, lun;
@@ -864,7 +1255,7 @@ static int do_gc(struct conv_ftl *conv_ftl, bool force)
 				ppa.g.lun = lun;
 				ppa.g.pl = 0;
 				lunp = get_lun(conv_ftl->ssd, &ppa);
-				clean_one_flashpg(conv_ftl, &ppa);
+				nsecs_latest = max(nsecs_latest, clean_one_flashpg(conv_ftl, &ppa));
 
 				if (flashpg == (spp->flashpgs_per_blk - 1)) {
 					struct convparams *cpp = &conv_ftl->cp;
@@ -879,88 +1270,305 @@ static int do_gc(struct conv_ftl *conv_ftl, bool force)
 							.interleave_pci_dma = false,
 							.ppa = &ppa,
 						};
-						ssd_advance_nand(conv_ftl->ssd, &gce);
+						nsecs_latest = max(nsecs_latest,
+								   ssd_advance_nand(conv_ftl->ssd, &gce));
 					}
 
 					lunp->gc_endtime = lunp->next_lun_avail_time;
 				}
 			}
 		}
+
+		/*
+		 * Let the dispatchers in between flash pages. Host writes may
+		 * invalidate pages of the victim, which are skipped then.
+		 */
+		spin_unlock(&conv_ftl->lock);
+		cond_resched();
+		spin_lock(&conv_ftl->lock);
 	}
 
 	/* update line status */
 	mark_line_free(conv_ftl, &ppa);
 
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
-	return 0;
+	return nsecs_latest;
 }
 
-static void foreground_gc(struct conv_ftl *conv_ftl)
+/*
+ * Static wear leveling. Cold data keep the blocks they sit on from being
+ * erased, so once the erase counts spread too far apart, the least erased
+ * line holding data is reclaimed to put its blocks back into rotation.
+ */
+static void wear_level(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	if (should_gc_high(conv_ftl)) {
-		NVMEV_DEBUG_VERBOSE("should_gc_high passed");
-		/* perform GC here until !should_gc(conv_ftl) */
-		do_gc(conv_ftl, true);
+	struct line_mgmt *lm = &conv_ftl->lm;
+	uint32_t thres = READ_ONCE(conv_ftl->cp.wl_thres_erases);
+	struct line *youngest = NULL, *line;
+	size_t i;
+
+	/* The data moved need free lines of their own */
+	if (!thres || lm->free_line_cnt <= conv_ftl->cp.gc_thres_lines_high + 1)
+		return;
+
+	list_for_each_entry(line, &lm->full_line_list, entry) {
+		if (!youngest || line->erase_cnt < youngest->erase_cnt)
+			youngest = line;
+	}
+	for (i = 1; i <= pqueue_size(lm->victim_line_pq); i++) {
+		line = lm->victim_line_pq->d[i];
+		if (!youngest || line->erase_cnt < youngest->erase_cnt)
+			youngest = line;
+	}
+
+	if (!youngest || lm->max_erase_cnt - youngest->erase_cnt <= thres)
+		return;
+
+	if (youngest->pos) {
+		pqueue_remove(lm->victim_line_pq, youngest);
+		youngest->pos = 0;
+		lm->victim_line_cnt--;
+	} else {
+		list_del_init(&youngest->entry);
+		lm->full_line_cnt--;
 	}
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
+
+	NVMEV_DEBUG("%s: line %d, erased %u times (max %u)\n", __func__, youngest->id,
+		    youngest->erase_cnt, lm->max_erase_cnt);
+	conv_ftl->nr_wl++;
+	conv_ftl->wl_pgs += youngest->vpc;
+	reclaim_line(conv_ftl, youngest);
 }
 
-static bool is_same_flash_page(struct conv_ftl *conv_ftl, struct ppa ppa1, struct ppa ppa2)
+static int do_gc(struct conv_ftl *conv_ftl, bool force)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct ssdparams *spp = &conv_ftl->ssd->sp;
-	uint32_t ppa1_page = ppa1.g.pg / spp->pgs_per_flashpg;
-	uint32_t ppa2_page = ppa2.g.pg / spp->pgs_per_flashpg;
+	struct line *victim_line = NULL;
+	uint32_t policy = READ_ONCE(conv_ftl->cp.gc_policy);
+	struct gc_policy_stat *stat = &conv_ftl->gc_stat[policy];
+	uint64_t nsecs_start = local_clock();
 
-	return (ppa1.h.blk_in_ssd == ppa2.h.blk_in_ssd) && (ppa1_page == ppa2_page);
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
+	victim_line = select_victim_line(conv_ftl, policy, force);
+	if (!victim_line) {
+		return -1;
+	}
+
+	stat->nr_gc++;
+	stat->gc_pgs += victim_line->vpc;
+
+	conv_ftl->wfc.credits_to_refill = victim_line->ipc;
+
+	stat->nsecs += max(reclaim_line(conv_ftl, victim_line), nsecs_start) - nsecs_start;
+
+	wear_level(conv_ftl);
+
+	return 0;
 }
 
-static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+static bool should_bg_gc(struct conv_ftl *conv_ftl)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
-	struct conv_ftl *conv_ftl = &conv_ftls[0];
-	/* spp are shared by all instances*/
-	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct line *victim_line;
 
-	struct nvme_command *cmd = req->cmd;
-	uint64_t lba = cmd->rw.slba;
-	uint64_t nr_lba = (cmd->rw.length + 1);
-	uint64_t start_lpn = lba / spp->secs_per_pg;
-	uint64_t end_lpn = (lba + nr_lba - 1) / spp->secs_per_pg;
-	uint64_t lpn;
-	uint64_t nsecs_start = req->nsecs_start;
-	uint64_t nsecs_completed, nsecs_latest = nsecs_start;
-	uint32_t xfer_size, i;
-	uint32_t nr_parts = ns->nr_parts;
+	if (conv_ftl->lm.free_line_cnt >= conv_ftl->cp.bg_gc_thres_lines)
+		return false;
 
-	struct ppa prev_ppa;
-	struct nand_cmd srd = {
-		.type = USER_IO,
-		.cmd = NAND_READ,
-		.stime = nsecs_start,
-		.interleave_pci_dma = true,
-	};
+	/* Nothing to gain from lines without invalid pages */
+	victim_line = pqueue_peek(conv_ftl->lm.victim_line_pq);
+	return victim_line && victim_line->ipc > 0;
+}
 
-	NVMEV_ASSERT(conv_ftls);
-	NVMEV_DEBUG_VERBOSE("%s: start_lpn=%lld, len=%lld, end_lpn=%lld", __func__, start_lpn, nr_lba, end_lpn);
-	if ((end_lpn / nr_parts) >= spp->tt_pgs) {
-		NVMEV_ERROR("%s: lpn passed FTL range (start_lpn=%lld > tt_pgs=%ld)\n", __func__,
-			    start_lpn, spp->tt_pgs);
-		return false;
+/* Reclaim one victim line of @conv_ftl if it needs it. Called with the lock held. */
+static void conv_gc_pass(struct conv_ftl *conv_ftl)
+{
+	if (should_gc_high(conv_ftl) || conv_ftl->lm.free_line_cnt < conv_ftl->gc_room) {
+		NVMEV_DEBUG_VERBOSE("should_gc_high passed");
+		if (do_gc(conv_ftl, true) == 0)
+			conv_ftl->nr_fg_gc++;
+	} else if (should_bg_gc(conv_ftl) && ssd_next_idle_time(conv_ftl->ssd) <= local_clock()) {
+		NVMEV_DEBUG("%s: free=%u victim=%u\n", __func__, conv_ftl->lm.free_line_cnt,
+			    conv_ftl->lm.victim_line_cnt);
+		if (do_gc(conv_ftl, true) == 0)
+			conv_ftl->nr_bg_gc++;
 	}
+}
 
-	if (LBA_TO_BYTE(nr_lba) <= (KB(4) * nr_parts)) {
-		srd.stime += spp->fw_4kb_rd_lat;
-	} else {
-		srd.stime += spp->fw_rd_lat;
+/*
+ * Dispatchers with nothing to dispatch hand background GC to the GC threads.
+ * A partition gets one victim line reclaimed per kick, and only while none
+ * of its LUNs is busy; the NAND time is charged from now on, so host I/O
+ * arriving later queues behind it like behind any other NAND operation.
+ */
+void conv_proc_idle(struct nvmev_ns *ns)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	uint32_t i;
+
+	for (i = 0; i < ns->nr_parts; i++) {
+		struct conv_ftl *conv_ftl = &conv_ftls[i];
+
+		if (READ_ONCE(conv_ftl->lm.free_line_cnt) >=
+			    READ_ONCE(conv_ftl->cp.bg_gc_thres_lines) ||
+		    READ_ONCE(conv_ftl->gc_wanted))
+			continue;
+
+		/* Somebody is working on this partition; it is not idle */
+		if (!spin_trylock(&conv_ftl->lock))
+			continue;
+
+		if (should_bg_gc(conv_ftl) && ssd_next_idle_time(conv_ftl->ssd) <= local_clock()) {
+			if (conv_ftl->gc_thread)
+				conv_gc_kick(conv_ftl);
+			else
+				conv_gc_pass(conv_ftl);
+		}
+		spin_unlock(&conv_ftl->lock);
+	}
+}
+
+/*
+ * Each partition reclaims its victim lines on a thread of its own, so that
+ * GC in one partition neither runs on nor stalls the dispatchers, and GC of
+ * the partitions proceeds in parallel.
+ */
+static int conv_gc_thread(void *data)
+{
+	struct conv_ftl *conv_ftl = data;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(conv_ftl->gc_wq,
+					 READ_ONCE(conv_ftl->gc_wanted) || kthread_should_stop());
+		if (kthread_should_stop())
+			break;
+
+		/* Kicks from now on ask for another round */
+		WRITE_ONCE(conv_ftl->gc_wanted, false);
+
+		spin_lock(&conv_ftl->lock);
+		conv_gc_pass(conv_ftl);
+		spin_unlock(&conv_ftl->lock);
+
+		cond_resched();
 	}
 
+	return 0;
+}
+
+/*
+ * Free lines a host write of [@start_lpn, @end_lpn] to @wp_id may open in each
+ * partition: its share of pages fills whole lines, and every write pointer
+ * it can touch opens one more for the pages left. Untagged data may go to the
+ * hot line as well.
+ */
+static uint32_t conv_room_needed(struct nvmev_ns *ns, uint64_t start_lpn, uint64_t end_lpn,
+				 uint32_t wp_id)
+{
+	struct ssdparams *spp = &((struct conv_ftl *)ns->ftls)[0].ssd->sp;
+	uint64_t nr_pgs = DIV_ROUND_UP(end_lpn - start_lpn + 1, ns->nr_parts);
+
+	return nr_pgs / spp->pgs_per_line + (wp_id == WP_DEFAULT ? 2 : 1);
+}
+
+/* Give back the lines conv_get_room() reserved for the first @nr_parts partitions */
+static void __conv_put_room(struct nvmev_ns *ns, uint64_t start_lpn, uint32_t nr_parts,
+			    uint32_t room)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	uint32_t i;
+
+	for (i = 0; i < nr_parts; i++) {
+		struct conv_ftl *conv_ftl = &conv_ftls[(start_lpn + i) % ns->nr_parts];
+
+		spin_lock(&conv_ftl->lock);
+		conv_ftl->lm.reserved_line_cnt -= room;
+		spin_unlock(&conv_ftl->lock);
+	}
+}
+
+/*
+ * Host writes to a partition short of free lines are retried later, after
+ * GC has made room. Admitted writes reserve the lines they may open, so that
+ * concurrent ones cannot drain the lines GC needs to make progress.
+ */
+static bool conv_get_room(struct nvmev_ns *ns, uint64_t start_lpn, uint64_t end_lpn,
+			  uint32_t wp_id)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	uint32_t nr_parts = min_t(uint64_t, ns->nr_parts, end_lpn - start_lpn + 1);
+	uint32_t room = conv_room_needed(ns, start_lpn, end_lpn, wp_id);
+	uint32_t i;
+
+	for (i = 0; i < nr_parts; i++) {
+		struct conv_ftl *conv_ftl = &conv_ftls[(start_lpn + i) % ns->nr_parts];
+		struct line_mgmt *lm = &conv_ftl->lm;
+		uint32_t wanted;
+
+		spin_lock(&conv_ftl->lock);
+		wanted = conv_ftl->cp.gc_thres_lines + lm->reserved_line_cnt + room;
+		if (lm->free_line_cnt >= wanted) {
+			lm->reserved_line_cnt += room;
+			conv_ftl->gc_room = 0;
+			spin_unlock(&conv_ftl->lock);
+			continue;
+		}
+
+		conv_ftl->gc_room = wanted;
+		if (conv_ftl->gc_thread)
+			conv_gc_kick(conv_ftl);
+		else
+			conv_gc_pass(conv_ftl);
+		spin_unlock(&conv_ftl->lock);
+
+		__conv_put_room(ns, start_lpn, i, room);
+		return false;
+	}
+
+	return true;
+}
+
+static void conv_put_room(struct nvmev_ns *ns, uint64_t start_lpn, uint64_t end_lpn,
+			  uint32_t wp_id)
+{
+	__conv_put_room(ns, start_lpn, min_t(uint64_t, ns->nr_parts, end_lpn - start_lpn + 1),
+			conv_room_needed(ns, start_lpn, end_lpn, wp_id));
+}
+
+static bool is_same_flash_page(struct conv_ftl *conv_ftl, struct ppa ppa1, struct ppa ppa2)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	uint32_t ppa1_page = ppa1.g.pg / spp->pgs_per_flashpg;
+	uint32_t ppa2_page = ppa2.g.pg / spp->pgs_per_flashpg;
+
+	return (ppa1.h.blk_in_ssd == ppa2.h.blk_in_ssd) && (ppa1_page == ppa2_page);
+}
+
+/*
+ * Issue the NAND reads of the LPNs in [@start_lpn, @end_lpn], starting at
+ * @srd->stime. Returns when the last of them completes, or 0 if none is mapped
+ * and no translation page had to be read.
+ */
+static uint64_t conv_read_lpns(struct nvmev_ns *ns, uint64_t start_lpn, uint64_t end_lpn,
+			       struct nand_cmd *srd)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct conv_ftl *conv_ftl;
+	/* spp are shared by all instances*/
+	struct ssdparams *spp = &conv_ftls[0].ssd->sp;
+	uint64_t lpn;
+	uint64_t nsecs_completed, nsecs_latest = 0;
+	uint32_t xfer_size, i;
+	uint32_t nr_parts = ns->nr_parts;
+	struct ppa prev_ppa;
+	struct nand_cmd rd = *srd;
+
 	for (i = 0; (i < nr_parts) && (start_lpn <= end_lpn); i++, start_lpn++) {
 		conv_ftl = &conv_ftls[start_lpn % nr_parts];
 		xfer_size = 0;
+
+		spin_lock(&conv_ftl->lock);
+		/* Data are read once their mappings are at hand */
+		rd.stime = cmt_fetch(conv_ftl, start_lpn / nr_parts,
+				     (end_lpn - (end_lpn - start_lpn) % nr_parts) / nr_parts, false,
+				     USER_IO, srd->stime);
+		if (rd.stime > srd->stime)
+			nsecs_latest = max(rd.stime, nsecs_latest);
 		prev_ppa = get_maptbl_ent(conv_ftl, start_lpn / nr_parts);
 
 		/* normal IO read path */
@@ -978,6 +1586,21 @@ static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvm
 				continue;
 			}
 
+			/*
+			 * Served from the write buffer, over PCIe for host reads.
+			 * Copy takes the data inside the device.
+			 */
+			if (wcache_hit(conv_ftl, local_lpn, rd.stime)) {
+				if (rd.interleave_pci_dma)
+					nsecs_completed =
+						ssd_advance_pcie(conv_ftl->ssd, rd.stime, spp->pgsz);
+				else
+					nsecs_completed = rd.stime;
+				nsecs_latest = max(nsecs_completed, nsecs_latest);
+				conv_ftl->wcache.hits++;
+				continue;
+			}
+
 			// aggregate read io in same flash page
 			if (mapped_ppa(&prev_ppa) &&
 			    is_same_flash_page(conv_ftl, cur_ppa, prev_ppa)) {
@@ -986,9 +1609,9 @@ static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvm
 			}
 
 			if (xfer_size > 0) {
-				srd.xfer_size = xfer_size;
-				srd.ppa = &prev_ppa;
-				nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &srd);
+				rd.xfer_size = xfer_size;
+				rd.ppa = &prev_ppa;
+				nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &rd);
 				nsecs_latest = max(nsecs_completed, nsecs_latest);
 			}
 
@@ -998,22 +1621,252 @@ static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvm
 
 		// issue remaining io
 		if (xfer_size > 0) {
-			srd.xfer_size = xfer_size;
-			srd.ppa = &prev_ppa;
-			nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &srd);
+			rd.xfer_size = xfer_size;
+			rd.ppa = &prev_ppa;
+			nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &rd);
 			nsecs_latest = max(nsecs_completed, nsecs_latest);
 		}
+
+		spin_unlock(&conv_ftl->lock);
 	}
 
-	ret->nsecs_target = nsecs_latest;
+	return nsecs_latest;
+}
+
+static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct conv_ftl *conv_ftl = &conv_ftls[0];
+	/* spp are shared by all instances*/
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+
+	struct nvme_command *cmd = req->cmd;
+	uint64_t lba = cmd->rw.slba;
+	uint64_t nr_lba = (cmd->rw.length + 1);
+	uint64_t start_lpn = lba / spp->secs_per_pg;
+	uint64_t end_lpn = (lba + nr_lba - 1) / spp->secs_per_pg;
+	uint64_t nsecs_start = req->nsecs_start;
+	uint32_t nr_parts = ns->nr_parts;
+
+	struct nand_cmd srd = {
+		.type = USER_IO,
+		.cmd = NAND_READ,
+		.stime = nsecs_start,
+		.interleave_pci_dma = true,
+	};
+
+	NVMEV_ASSERT(conv_ftls);
+	NVMEV_DEBUG_VERBOSE("%s: start_lpn=%lld, len=%lld, end_lpn=%lld", __func__, start_lpn, nr_lba, end_lpn);
+	if ((end_lpn / nr_parts) >= spp->tt_pgs) {
+		NVMEV_ERROR("%s: lpn passed FTL range (start_lpn=%lld > tt_pgs=%ld)\n", __func__,
+			    start_lpn, spp->tt_pgs);
+		return false;
+	}
+
+	if (LBA_TO_BYTE(nr_lba) <= (KB(4) * nr_parts)) {
+		srd.stime += spp->fw_4kb_rd_lat;
+	} else {
+		srd.stime += spp->fw_rd_lat;
+	}
+
+	ret->nsecs_target = max(conv_read_lpns(ns, start_lpn, end_lpn, &srd), nsecs_start);
 	ret->status = NVME_SC_SUCCESS;
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return true;
 }
 
+/* Write pointer of a write command from its DTYPE and DSPEC fields */
+static uint32_t conv_cmd_wp(struct nvmev_ns *ns, uint16_t control, uint16_t dspec)
+{
+	if (((control >> 4) & 0xf) != NVME_DIR_STREAMS || !READ_ONCE(ns->streams_enabled) ||
+	    dspec == 0)
+		return WP_DEFAULT;
+
+	return WP_STREAM(dspec);
+}
+
+/* Untagged data overwritten soon after being written go to the hot line */
+static bool is_hot_overwrite(struct conv_ftl *conv_ftl, struct ppa *old_ppa)
+{
+	uint32_t thres = READ_ONCE(conv_ftl->cp.hot_thres_lines);
+	struct line *line = get_line(conv_ftl, old_ppa);
+
+	/* Lines that are still open have no seq yet and are the youngest */
+	return thres && (line->seq == 0 || conv_ftl->lm.nr_filled - line->seq < thres);
+}
+
+/*
+ * Program the LPNs in [@start_lpn, @end_lpn] to new pages of write pointer
+ * @wp_id, starting at @swr->stime. With @wbuf, the data hold write buffer,
+ * which is released once their wordline is programmed. Returns when the last
+ * program completes.
+ */
+static uint64_t conv_write_lpns(struct nvmev_ns *ns, uint64_t start_lpn, uint64_t end_lpn,
+				uint32_t wp_id, struct nand_cmd *swr, int sqid, struct buffer *wbuf)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct conv_ftl *conv_ftl;
+	struct ssdparams *spp = &conv_ftls[0].ssd->sp;
+	uint64_t nsecs_latest = swr->stime;
+	uint64_t lpn;
+	uint32_t nr_parts = ns->nr_parts;
+	uint32_t i;
+	struct nand_cmd wr = *swr;
+
+	/*
+	 * Walk one partition at a time so that its lock is taken once per command.
+	 * LPNs still land on each partition in ascending order.
+	 */
+	for (i = 0; (i < nr_parts) && (start_lpn + i <= end_lpn); i++) {
+		conv_ftl = &conv_ftls[(start_lpn + i) % nr_parts];
+
+		spin_lock(&conv_ftl->lock);
+		/* Programs wait for the mappings they update */
+		wr.stime = cmt_fetch(conv_ftl, (start_lpn + i) / nr_parts,
+				     (end_lpn - (end_lpn - start_lpn - i) % nr_parts) / nr_parts, true,
+				     USER_IO, swr->stime);
+		for (lpn = start_lpn + i; lpn <= end_lpn; lpn += nr_parts) {
+			uint64_t local_lpn;
+			uint64_t nsecs_completed = 0;
+			struct write_pointer *wpp;
+			struct ppa ppa;
+
+			local_lpn = lpn / nr_parts;
+			ppa = get_maptbl_ent(
+				conv_ftl, local_lpn); // Check whether the given LPN has been written before
+			if (wp_id == WP_DEFAULT && mapped_ppa(&ppa) && is_hot_overwrite(conv_ftl, &ppa))
+				wpp = __get_wp(conv_ftl, USER_IO, WP_HOT);
+			else
+				wpp = __get_wp(conv_ftl, USER_IO, wp_id);
+			if (!wpp->curline)
+				prepare_write_pointer(conv_ftl, wpp);
+
+			if (mapped_ppa(&ppa)) {
+				/* update old page information first */
+				mark_page_invalid(conv_ftl, &ppa);
+				set_rmap_ent(conv_ftl, INVALID_LPN, &ppa);
+				NVMEV_DEBUG("%s: %lld is invalid, ", __func__, ppa2pgidx(conv_ftl, &ppa));
+			}
+
+			/* new write */
+			ppa = get_new_page(conv_ftl, wpp);
+			/* update maptbl */
+			set_maptbl_ent(conv_ftl, local_lpn, &ppa);
+			NVMEV_DEBUG("%s: got new ppa %lld, ", __func__, ppa2pgidx(conv_ftl, &ppa));
+			/* update rmap */
+			set_rmap_ent(conv_ftl, local_lpn, &ppa);
+
+			mark_page_valid(conv_ftl, &ppa);
+			if (wbuf) {
+				wcache_insert(conv_ftl, local_lpn, wpp);
+				wpp->nr_buffered++;
+			} else {
+				wcache_drop(conv_ftl, local_lpn);
+			}
+
+			/* need to advance the write pointer here */
+			advance_write_pointer(conv_ftl, wpp);
+
+			/* Aggregate write io in flash page */
+			if (last_pg_in_wordline(conv_ftl, &ppa)) {
+				wr.ppa = &ppa;
+
+				nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &wr);
+				nsecs_latest = max(nsecs_completed, nsecs_latest);
+				wcache_program(wpp, nsecs_completed);
+
+				/* Copies share the wordline but never held any buffer */
+				if (wpp->nr_buffered)
+					schedule_internal_operation(sqid, nsecs_completed,
+								    conv_ftl->ssd->write_buffer,
+								    wpp->nr_buffered * spp->pgsz);
+				wpp->nr_buffered = 0;
+			}
+
+			conv_ftl->gc_stat[READ_ONCE(conv_ftl->cp.gc_policy)].host_pgs++;
+			consume_write_credit(conv_ftl);
+			check_and_refill_write_credit(conv_ftl);
+		}
+		spin_unlock(&conv_ftl->lock);
+	}
+
+	return nsecs_latest;
+}
+
+/*
+ * Pad the wordline @wpp is filling and program it, starting at @stime. The
+ * write buffer held by its data is released once programmed. Returns when
+ * the program completes, or 0 if nothing was waiting.
+ */
+static uint64_t pad_wordline(struct conv_ftl *conv_ftl, struct write_pointer *wpp, uint64_t stime,
+			     int sqid)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	uint32_t nr_data = wpp->pg % spp->pgs_per_oneshotpg;
+	uint64_t nsecs_completed;
+	struct ppa ppa;
+	struct nand_cmd swr = {
+		.type = USER_IO,
+		.cmd = NAND_WRITE,
+		.stime = stime,
+		.interleave_pci_dma = false,
+		.xfer_size = spp->pgsz * spp->pgs_per_oneshotpg,
+	};
+
+	if (!wpp->curline || nr_data == 0)
+		return 0;
+
+	do {
+		ppa = get_new_page(conv_ftl, wpp);
+		mark_page_padded(conv_ftl, &ppa);
+		advance_write_pointer(conv_ftl, wpp);
+		consume_write_credit(conv_ftl);
+	} while (!last_pg_in_wordline(conv_ftl, &ppa));
+
+	swr.ppa = &ppa;
+	nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &swr);
+	wcache_program(wpp, nsecs_completed);
+
+	if (wpp->nr_buffered)
+		schedule_internal_operation(sqid, nsecs_completed, conv_ftl->ssd->write_buffer,
+					    wpp->nr_buffered * spp->pgsz);
+	wpp->nr_buffered = 0;
+
+	/* GC may write to @wpp too, so not before the wordline is done */
+	check_and_refill_write_credit(conv_ftl);
+
+	return nsecs_completed;
+}
+
+/* FUA: program the partial wordlines that the LPNs in [@start_lpn, @end_lpn] went to */
+static uint64_t conv_pad_cmd_wps(struct nvmev_ns *ns, uint64_t start_lpn, uint64_t end_lpn,
+				 uint32_t wp_id, uint64_t stime, int sqid)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct conv_ftl *conv_ftl;
+	uint64_t nsecs_latest = 0;
+	uint32_t nr_parts = ns->nr_parts;
+	uint32_t i;
+
+	for (i = 0; (i < nr_parts) && (start_lpn + i <= end_lpn); i++) {
+		conv_ftl = &conv_ftls[(start_lpn + i) % nr_parts];
+
+		spin_lock(&conv_ftl->lock);
+		nsecs_latest = max(pad_wordline(conv_ftl, __get_wp(conv_ftl, USER_IO, wp_id), stime,
+						sqid),
+				   nsecs_latest);
+		/* Untagged data may have gone to the hot line as well */
+		if (wp_id == WP_DEFAULT)
+			nsecs_latest = max(pad_wordline(conv_ftl, __get_wp(conv_ftl, USER_IO, WP_HOT),
+							stime, sqid),
+					   nsecs_latest);
+		spin_unlock(&conv_ftl->lock);
+	}
+
+	return nsecs_latest;
+}
+
 static bool conv_write(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
 	struct conv_ftl *conv_ftl = &conv_ftls[0];
 
@@ -1027,12 +1880,12 @@ static bool conv_write(struct nvmev_ns *ns, struct nvmev_request *req, struct nv
 	uint64_t start_lpn = lba / spp->secs_per_pg;
 	uint64_t end_lpn = (lba + nr_lba - 1) / spp->secs_per_pg;
 
-	uint64_t lpn;
 	uint32_t nr_parts = ns->nr_parts;
 
 	uint64_t nsecs_latest;
 	uint64_t nsecs_xfer_completed;
 	uint32_t allocated_buf_size;
+	uint32_t wp_id;
 
 	struct nand_cmd swr = {
 		.type = USER_IO,
@@ -1048,59 +1901,28 @@ static bool conv_write(struct nvmev_ns *ns, struct nvmev_request *req, struct nv
 		return false;
 	}
 
+	wp_id = conv_cmd_wp(ns, cmd->rw.control, cmd->rw.dsmgmt >> 16);
+	if (!conv_get_room(ns, start_lpn, end_lpn, wp_id))
+		return false;
+
 	allocated_buf_size = buffer_allocate(wbuf, LBA_TO_BYTE(nr_lba));
-	if (allocated_buf_size < LBA_TO_BYTE(nr_lba))
+	if (allocated_buf_size < LBA_TO_BYTE(nr_lba)) {
+		conv_put_room(ns, start_lpn, end_lpn, wp_id);
 		return false;
+	}
 
 	nsecs_latest =
 		ssd_advance_write_buffer(conv_ftl->ssd, req->nsecs_start, LBA_TO_BYTE(nr_lba));
 	nsecs_xfer_completed = nsecs_latest;
 
 	swr.stime = nsecs_latest;
+	nsecs_latest = conv_write_lpns(ns, start_lpn, end_lpn, wp_id, &swr, req->sq_id, wbuf);
+	conv_put_room(ns, start_lpn, end_lpn, wp_id);
 
-	for (lpn = start_lpn; lpn <= end_lpn; lpn++) {
-		uint64_t local_lpn;
-		uint64_t nsecs_completed = 0;
-		struct ppa ppa;
-
-		conv_ftl = &conv_ftls[lpn % nr_parts];
-		local_lpn = lpn / nr_parts;
-		ppa = get_maptbl_ent(
-			conv_ftl, local_lpn); // Check whether the given LPN has been written before
-		if (mapped_ppa(&ppa)) {
-			/* update old page information first */
-			mark_page_invalid(conv_ftl, &ppa);
-			set_rmap_ent(conv_ftl, INVALID_LPN, &ppa);
-			NVMEV_DEBUG("%s: %lld is invalid, ", __func__, ppa2pgidx(conv_ftl, &ppa));
-		}
-
-		/* new write */
-		ppa = get_new_page(conv_ftl, USER_IO);
-		/* update maptbl */
-		set_maptbl_ent(conv_ftl, local_lpn, &ppa);
-		NVMEV_DEBUG("%s: got new ppa %lld, ", __func__, ppa2pgidx(conv_ftl, &ppa));
-		/* update rmap */
-		set_rmap_ent(conv_ftl, local_lpn, &ppa);
-
-		mark_page_valid(conv_ftl, &ppa);
-
-		/* need to advance the write pointer here */
-		advance_write_pointer(conv_ftl, USER_IO);
-
-		/* Aggregate write io in flash page */
-		if (last_pg_in_wordline(conv_ftl, &ppa)) {
-			swr.ppa = &ppa;
-
-			nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &swr);
-			nsecs_latest = max(nsecs_completed, nsecs_latest);
-
-			schedule_internal_operation(req->sq_id, nsecs_completed, wbuf,
-						    spp->pgs_per_oneshotpg * spp->pgsz);
-		}
-
-		consume_write_credit(conv_ftl);
-		check_and_refill_write_credit(conv_ftl);
-	}
+	if (cmd->rw.control & NVME_RW_FUA)
+		nsecs_latest = max(conv_pad_cmd_wps(ns, start_lpn, end_lpn, wp_id,
+						    nsecs_xfer_completed, req->sq_id),
+				   nsecs_latest);
 
 	if ((cmd->rw.control & NVME_RW_FUA) || (spp->write_early_completion == 0)) {
 		/* Wait all flash operations */
@@ -1111,34 +1933,278 @@ static bool conv_write(struct nvmev_ns *ns, struct nvmev_request *req, struct nv
 	}
 	ret->status = NVME_SC_SUCCESS;
 
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return true;
 }
 
 static void conv_flush(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	uint64_t start, latest;
-	uint32_t i;
+	uint32_t i, j;
 	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
 
 	start = local_clock();
 	latest = start;
 	for (i = 0; i < ns->nr_parts; i++) {
-		latest = max(latest, ssd_next_idle_time(conv_ftls[i].ssd));
+		struct conv_ftl *conv_ftl = &conv_ftls[i];
+
+		spin_lock(&conv_ftl->lock);
+		/* Data waiting for the rest of their wordline are programmed with padding */
+		for (j = 0; j < NR_WPS; j++)
+			pad_wordline(conv_ftl, &conv_ftl->wp[j], req->nsecs_start, req->sq_id);
+		pad_wordline(conv_ftl, &conv_ftl->gc_wp, req->nsecs_start, req->sq_id);
+
+		latest = max(latest, ssd_next_idle_time(conv_ftl->ssd));
+		spin_unlock(&conv_ftl->lock);
 	}
 
 	NVMEV_DEBUG_VERBOSE("%s: latency=%llu\n", __func__, latest - start);
 
 	ret->status = NVME_SC_SUCCESS;
 	ret->nsecs_target = latest;
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return;
 }
 
+/* Unmap the LPNs in [@start_lpn, @end_lpn] so that GC no longer copies them */
+static void conv_unmap(struct nvmev_ns *ns, uint64_t start_lpn, uint64_t end_lpn)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct conv_ftl *conv_ftl;
+	uint32_t nr_parts = ns->nr_parts;
+	struct ppa unmapped = { .ppa = UNMAPPED_PPA };
+	uint64_t lpn;
+	uint32_t i;
+
+	for (i = 0; (i < nr_parts) && (start_lpn + i <= end_lpn); i++) {
+		conv_ftl = &conv_ftls[(start_lpn + i) % nr_parts];
+
+		spin_lock(&conv_ftl->lock);
+		cmt_fetch(conv_ftl, (start_lpn + i) / nr_parts,
+			  (end_lpn - (end_lpn - start_lpn - i) % nr_parts) / nr_parts, true, USER_IO, 0);
+		for (lpn = start_lpn + i; lpn <= end_lpn; lpn += nr_parts) {
+			uint64_t local_lpn = lpn / nr_parts;
+			struct ppa ppa = get_maptbl_ent(conv_ftl, local_lpn);
+
+			if (!mapped_ppa(&ppa))
+				continue;
+
+			mark_page_invalid(conv_ftl, &ppa);
+			set_rmap_ent(conv_ftl, INVALID_LPN, &ppa);
+			set_maptbl_ent(conv_ftl, local_lpn, &unmapped);
+			wcache_drop(conv_ftl, local_lpn);
+		}
+		spin_unlock(&conv_ftl->lock);
+	}
+}
+
+/*
+ * Dataset Management. Only deallocate does anything; pages partially covered
+ * by a range are kept as they are.
+ */
+static bool conv_dsm(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+{
+	struct conv_ftl *conv_ftl = &((struct conv_ftl *)ns->ftls)[0];
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct nvme_dsm_cmd *cmd = &req->cmd->dsm;
+	uint32_t nr_ranges = (cmd->nr & 0xff) + 1;
+	uint64_t nr_lbas = BYTE_TO_LBA(ns->size);
+	struct nvme_dsm_range *ranges;
+	uint16_t status;
+	uint32_t i;
+
+	ret->nsecs_target = req->nsecs_start; // metadata only
+	ret->status = NVME_SC_SUCCESS;
+
+	if (!(cmd->attributes & NVME_DSMGMT_AD))
+		return true;
+
+	ranges = kmalloc_array(nr_ranges, sizeof(*ranges), GFP_KERNEL);
+	if (!ranges)
+		return false;
+
+	status = nvmev_dptr_copy(cmd->flags, cmd->prp1, cmd->prp2, ranges,
+				 nr_ranges * sizeof(*ranges), true, NVMEV_COPY_MEMCPY);
+	if (status != NVME_SC_SUCCESS) {
+		ret->status = status;
+		goto out;
+	}
+
+	/* Validate every range before anything is deallocated */
+	for (i = 0; i < nr_ranges; i++) {
+		if (ranges[i].slba >= nr_lbas || ranges[i].nlb > nr_lbas - ranges[i].slba) {
+			NVMEV_ERROR("%s: range %u passed namespace (slba=%lld nlb=%u)\n", __func__, i,
+				    ranges[i].slba, ranges[i].nlb);
+			ret->status = NVME_SC_LBA_RANGE;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < nr_ranges; i++) {
+		uint64_t start_lpn = DIV_ROUND_UP(ranges[i].slba, spp->secs_per_pg);
+		uint64_t end_lpn = (ranges[i].slba + ranges[i].nlb) / spp->secs_per_pg;
+		uint64_t nr_bytes = (end_lpn - start_lpn) * spp->pgsz;
+
+		if (start_lpn < end_lpn) {
+			conv_unmap(ns, start_lpn, end_lpn - 1);
+			/* Deallocated pages read as zeroes */
+			nvmev_zero_range(ns, start_lpn * spp->pgsz, nr_bytes);
+		}
+	}
+
+out:
+	kfree(ranges);
+	return true;
+}
+
+/*
+ * Write Zeroes only touches metadata: whole pages are deallocated, and the
+ * sectors of partially covered pages are cleared in place.
+ */
+static bool conv_write_zeroes(struct nvmev_ns *ns, struct nvmev_request *req,
+			      struct nvmev_result *ret)
+{
+	struct conv_ftl *conv_ftl = &((struct conv_ftl *)ns->ftls)[0];
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct nvme_command *cmd = req->cmd;
+	uint64_t lba = cmd->rw.slba;
+	uint64_t nr_lba = (cmd->rw.length + 1);
+	uint64_t start_lpn = DIV_ROUND_UP(lba, spp->secs_per_pg);
+	uint64_t end_lpn = (lba + nr_lba) / spp->secs_per_pg;
+
+	ret->nsecs_target = req->nsecs_start;
+
+	if (lba >= BYTE_TO_LBA(ns->size) || nr_lba > BYTE_TO_LBA(ns->size) - lba) {
+		NVMEV_ERROR("%s: lba passed namespace (slba=%lld nlb=%lld)\n", __func__, lba,
+			    nr_lba);
+		ret->status = NVME_SC_LBA_RANGE;
+		return true;
+	}
+
+	if (start_lpn < end_lpn)
+		conv_unmap(ns, start_lpn, end_lpn - 1);
+	nvmev_zero_range(ns, LBA_TO_BYTE(lba), LBA_TO_BYTE(nr_lba));
+
+	ret->nsecs_target = req->nsecs_start + spp->fw_wbuf_lat0;
+	ret->status = NVME_SC_SUCCESS;
+	return true;
+}
+
+/*
+ * Copy moves data inside the device: the source pages are read from NAND and
+ * programmed to the destination without going over PCIe or the write buffer.
+ */
+static bool conv_copy(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+{
+	struct conv_ftl *conv_ftl = &((struct conv_ftl *)ns->ftls)[0];
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct nvme_copy_command *cmd = &req->cmd->copy;
+	uint32_t nr_ranges = cmd->nr_range + 1;
+	uint64_t nr_lbas = BYTE_TO_LBA(ns->size);
+	uint64_t dlba = cmd->sdlba;
+	uint64_t nr_lba = 0;
+	uint64_t start_lpn, end_lpn;
+	uint32_t wp_id;
+	uint64_t nsecs_latest = req->nsecs_start;
+	struct nvme_copy_range *ranges;
+	uint16_t status;
+	uint32_t i;
+
+	struct nand_cmd srd = {
+		.type = USER_IO,
+		.cmd = NAND_READ,
+		.stime = req->nsecs_start + spp->fw_rd_lat,
+		.interleave_pci_dma = false,
+	};
+	struct nand_cmd swr = {
+		.type = USER_IO,
+		.cmd = NAND_WRITE,
+		.interleave_pci_dma = false,
+		.xfer_size = spp->pgsz * spp->pgs_per_oneshotpg,
+	};
+
+	ret->nsecs_target = req->nsecs_start;
+	ret->status = NVME_SC_SUCCESS;
+
+	if (cmd->format != 0) {
+		ret->status = NVME_SC_INVALID_FIELD;
+		return true;
+	}
+	if (nr_ranges > NVMEV_MSRC + 1) {
+		ret->status = NVME_SC_CMD_SIZE_LIMIT;
+		return true;
+	}
+
+	ranges = kmalloc_array(nr_ranges, sizeof(*ranges), GFP_KERNEL);
+	if (!ranges)
+		return false;
+
+	status = nvmev_dptr_copy(cmd->flags, cmd->prp1, cmd->prp2, ranges,
+				 nr_ranges * sizeof(*ranges), true, NVMEV_COPY_MEMCPY);
+	if (status != NVME_SC_SUCCESS) {
+		ret->status = status;
+		goto out;
+	}
+
+	/* Validate the whole command before anything is moved */
+	for (i = 0; i < nr_ranges; i++) {
+		if (ranges[i].nlb + 1 > NVMEV_MSSRL) {
+			ret->status = NVME_SC_CMD_SIZE_LIMIT;
+			goto out;
+		}
+		if (ranges[i].slba >= nr_lbas || ranges[i].nlb + 1 > nr_lbas - ranges[i].slba) {
+			NVMEV_ERROR("%s: range %u passed namespace (slba=%lld nlb=%u)\n", __func__, i,
+				    ranges[i].slba, ranges[i].nlb);
+			ret->status = NVME_SC_LBA_RANGE;
+			goto out;
+		}
+		nr_lba += ranges[i].nlb + 1;
+	}
+	if (nr_lba > NVMEV_MCL) {
+		ret->status = NVME_SC_CMD_SIZE_LIMIT;
+		goto out;
+	}
+	if (dlba >= nr_lbas || nr_lba > nr_lbas - dlba) {
+		NVMEV_ERROR("%s: destination passed namespace (sdlba=%lld nlb=%lld)\n", __func__,
+			    dlba, nr_lba);
+		ret->status = NVME_SC_LBA_RANGE;
+		goto out;
+	}
+
+	/* A page shared by two ranges is programmed once for each */
+	start_lpn = dlba / spp->secs_per_pg;
+	end_lpn = (dlba + nr_lba - 1) / spp->secs_per_pg + nr_ranges - 1;
+	wp_id = conv_cmd_wp(ns, cmd->control, cmd->dspec);
+	if (!conv_get_room(ns, start_lpn, end_lpn, wp_id)) {
+		kfree(ranges);
+		return false;
+	}
+
+	for (i = 0; i < nr_ranges; i++) {
+		uint64_t slba = ranges[i].slba;
+		uint64_t nlb = ranges[i].nlb + 1;
+		uint64_t nsecs_read;
+
+		/* Programming starts once the source of the range has been read */
+		nsecs_read = conv_read_lpns(ns, slba / spp->secs_per_pg,
+					    (slba + nlb - 1) / spp->secs_per_pg, &srd);
+		swr.stime = max(nsecs_read, srd.stime);
+		nsecs_latest = max(nsecs_latest,
+				   conv_write_lpns(ns, dlba / spp->secs_per_pg,
+						   (dlba + nlb - 1) / spp->secs_per_pg, wp_id, &swr,
+						   req->sq_id, NULL));
+
+		nvmev_move_range(ns, LBA_TO_BYTE(dlba), LBA_TO_BYTE(slba), LBA_TO_BYTE(nlb));
+		dlba += nlb;
+	}
+	conv_put_room(ns, start_lpn, end_lpn, wp_id);
+
+	ret->nsecs_target = nsecs_latest;
+out:
+	kfree(ranges);
+	return true;
+}
+
 bool conv_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct nvme_command *cmd = req->cmd;
 
 	NVMEV_ASSERT(ns->csi == NVME_CSI_NVM);
@@ -1155,12 +2221,23 @@ bool conv_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struc
 	case nvme_cmd_flush:
 		conv_flush(ns, req, ret);
 		break;
+	case nvme_cmd_dsm:
+		if (!conv_dsm(ns, req, ret))
+			return false;
+		break;
+	case nvme_cmd_write_zeroes:
+		if (!conv_write_zeroes(ns, req, ret))
+			return false;
+		break;
+	case nvme_cmd_copy:
+		if (!conv_copy(ns, req, ret))
+			return false;
+		break;
 	default:
 		NVMEV_ERROR("%s: command not implemented: %s (0x%x)\n", __func__,
 				nvme_opcode_string(cmd->common.opcode), cmd->common.opcode);
 		break;
 	}
 
-	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return true;
 }
@@ -4,6 +4,7 @@
 #define _NVMEVIRT_CONV_FTL_H
 
 #include <linux/types.h>
+#include <linux/wait.h>
 #include "pqueue/pqueue.h"
 #include "ssd_config.h"
 #include "ssd.h"
@@ -23,10 +24,47 @@ victim line的概念:
 	优先队列（Priority Queue）：victim_line_pq 是一个优先队列，用于管理候选的Victim Line。优先队列根据一定的规则（如有效页面数量、最近最少使用等）对行进行排序，选择最优的行作为Victim Line。
 	有效页面和无效页面：每条行记录了其有效页面数（vpc）和无效页面数（ipc）。优先选择有效页面较少的行作为Victim Line，因为这样的行在垃圾回收时需要复制的有效页面较少，效率更高。
 */
+/* GC victim selection policies */
+enum {
+	GC_POLICY_GREEDY, /* Fewest valid pages */
+	GC_POLICY_COST_BENEFIT, /* Largest age * (1 - u) / 2u */
+	GC_POLICY_D_CHOICES, /* Fewest valid pages of GC_D_CHOICES random lines */
+	GC_POLICY_FIFO, /* Oldest line */
+	NR_GC_POLICIES,
+};
+
+#define GC_D_CHOICES 8
+
+/*
+ * Host data go through one of several write pointers, each filling its own
+ * line: untagged writes, untagged writes classified as hot, and NR_STREAMS
+ * for the stream identifiers of the Streams directive.
+ */
+#define NR_STREAMS 8
+enum {
+	WP_DEFAULT,
+	WP_HOT,
+	WP_STREAM_BASE,
+	NR_WPS = WP_STREAM_BASE + NR_STREAMS,
+};
+#define WP_STREAM(id) (WP_STREAM_BASE + ((id) - 1) % NR_STREAMS)
+
+/* Counted while the policy is in effect */
+struct gc_policy_stat {
+	uint64_t nr_gc; /* Victim lines reclaimed */
+	uint64_t host_pgs; /* Pages written by the host */
+	uint64_t gc_pgs; /* Pages copied by GC */
+	uint64_t nsecs; /* Time until the NAND operations of each GC completed */
+};
+
 //垃圾回收参数
 struct convparams {
 	uint32_t gc_thres_lines;//垃圾回收线数量(常规) 线:指的是存储设备中的物理单元，每条线可以包含多个页面. 当空闲线的数量减少到2条或以下时，系统将触发垃圾回收操作，以确保有足够的空闲线供主机写入和垃圾回收使用。
 	uint32_t gc_thres_lines_high;//垃圾回收线数量(高优先级)线:指的是存储设备中的物理单元，每条线可以包含多个页面. 当空闲线的数量减少到2条或以下时，系统将触发垃圾回收操作，以确保有足够的空闲线供主机写入和垃圾回收使用。
+	uint32_t bg_gc_thres_lines; /* Background GC reclaims up to this many free lines when idle, 0 disables it */
+	uint32_t gc_policy; /* GC_POLICY_* */
+	uint32_t hot_thres_lines; /* Untagged overwrites of data younger than this many lines are hot, 0 disables it */
+	uint32_t wl_thres_erases; /* Static wear leveling kicks in past this erase count spread, 0 disables it */
 	bool enable_gc_delay;// 启用垃圾回收延迟
 
 	double op_area_pcent;//预留空间百分比
@@ -40,6 +78,8 @@ struct line {
 	struct list_head entry;//用于将该行插入到链表中的节点。
 	/* position in the priority queue for victim lines */
 	size_t pos;//该行在优先队列中的位置，用于选择牺牲行。
+	uint64_t seq; /* Order in which the line got filled up, for its age */
+	uint32_t erase_cnt; /* Erase count of the blocks of this line */
 };
 
 /*记录下一个写入地址 wp: record next write addr */
@@ -50,21 +90,26 @@ struct write_pointer {
 	uint32_t pl;// Plane
 	uint32_t blk;// Block
 	uint32_t pg;// Page
+	struct list_head wc_pending; /* Write cache slots of the wordline being filled */
+	uint32_t nr_buffered; /* Pages of the wordline being filled that hold write buffer */
 };
 
 /* 行管理 */
 struct line_mgmt {
 	struct line *lines;// 行数组
 
-	/* free line list, we only need to maintain a list of blk numbers */
-	struct list_head free_line_list;// 空闲行链表
+	/* Free lines, least erased first */
+	pqueue_t *free_line_pq;
 	pqueue_t *victim_line_pq;//  牺牲行优先队列, 这个队列如何管理?
 	struct list_head full_line_list;// 满行链表
 
 	uint32_t tt_lines;// 总行数
 	uint32_t free_line_cnt;// 空闲行数量
+	uint32_t reserved_line_cnt; /* Free lines promised to admitted host writes */
 	uint32_t victim_line_cnt;// 牺牲行数量
 	uint32_t full_line_cnt;// 满行数量
+	uint64_t nr_filled; /* Lines filled up so far */
+	uint32_t max_erase_cnt;
 };
 
 /* 写流量控制 */
@@ -73,16 +118,91 @@ struct write_flow_control {
 	uint32_t credits_to_refill; // 需要补充的信用额度
 };
 
+/*
+ * maptbl and rmap entries are packed into 32 bits: pg, blk, pl, lun and ch
+ * from the bottom, each as wide as the geometry needs.
+ */
+#define UNMAPPED_ENT (U32_MAX)
+
+struct map_fmt {
+	uint8_t blk_shift;
+	uint8_t pl_shift;
+	uint8_t lun_shift;
+	uint8_t ch_shift;
+	uint8_t nr_bits;
+};
+
+/*
+ * Index of the host data still held by the write buffer: the pages of
+ * wordlines not programmed yet and of those being programmed. Slots are
+ * reused in write order.
+ */
+struct wcache_slot {
+	uint64_t lpn; /* INVALID_LPN once overwritten */
+	uint64_t nsecs_done; /* When the wordline is programmed, U64_MAX until it is issued */
+	struct hlist_node hnode;
+	struct list_head pending; /* On write_pointer::wc_pending until issued */
+};
+
+struct wcache {
+	uint32_t nr_slots;
+	uint32_t head;
+	uint32_t hash_bits;
+	struct wcache_slot *slots;
+	struct hlist_head *hash;
+	uint64_t hits;
+};
+
+/*
+ * Cached mapping table of DFTL. Translation pages of the mapping table are
+ * kept in NAND and cached whole; a miss reads the translation page before
+ * the mapping can be used, and evicting a dirty one writes it back.
+ */
+#define CMT_NONE (U32_MAX)
+
+struct cmt_slot {
+	uint32_t tpage;
+	bool dirty;
+	bool ref; /* Referenced since the clock hand last passed */
+};
+
+struct cmt {
+	uint32_t nr_slots; /* 0 when the whole mapping table is cached */
+	uint32_t nr_used;
+	uint32_t hand;
+	uint32_t ents_per_tpage;
+	uint32_t nr_tpages;
+	uint32_t *tpage_slot; /* Slot of each translation page, or CMT_NONE */
+	struct cmt_slot *slots;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t writebacks;
+};
+
 struct conv_ftl {
 	struct ssd *ssd;// 指向SSD的指针
 
 	struct convparams cp;// 垃圾回收参数
-	struct ppa *maptbl; /*页级映射表(逻辑地址到物理地址的映射关系) page level mapping table */
-	uint64_t *rmap; /*反向映射表(从物理地址反向查找对应的逻辑地址)，假设存储在OOB（带外数据区） reverse mapptbl, assume it's stored in OOB */
-	struct write_pointer wp;// 写指针
+	uint32_t *maptbl; /*页级映射表(逻辑地址到物理地址的映射关系) page level mapping table, in map_fmt */
+	uint32_t *rmap; /*反向映射表(从物理地址反向查找对应的逻辑地址)，假设存储在OOB（带外数据区） reverse mapptbl, assume it's stored in OOB */
+	struct map_fmt map_fmt;
+	struct cmt cmt;
+	struct wcache wcache;
+	struct write_pointer wp[NR_WPS];// 写指针, opened on first use
 	struct write_pointer gc_wp;// 垃圾回收写指针
 	struct line_mgmt lm;// 行管理结构
 	struct write_flow_control wfc;// 写流量控制结构
+	uint64_t nr_fg_gc; /* Victim lines reclaimed in the write path */
+	uint64_t nr_bg_gc; /* Victim lines reclaimed while idle */
+	uint64_t nr_wl; /* Lines reclaimed by static wear leveling */
+	uint64_t wl_pgs; /* Pages migrated by static wear leveling */
+	struct gc_policy_stat gc_stat[NR_GC_POLICIES];
+	uint32_t gc_rand; /* xorshift state for GC_POLICY_D_CHOICES */
+	spinlock_t lock; /* Serializes the dispatchers and the GC thread working on this partition */
+	struct task_struct *gc_thread; /* Reclaims the victim lines of this partition */
+	wait_queue_head_t gc_wq;
+	bool gc_wanted;
+	uint32_t gc_room; /* Free lines the last host write turned away needed */
 };
 /*
 带外存储器是指NAND闪存中除了主数据区域之外的一小部分额外存储空间。
@@ -97,4 +217,7 @@ void conv_remove_namespace(struct nvmev_ns *ns);
 bool conv_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req,
 			   struct nvmev_result *ret);
 
+void conv_proc_idle(struct nvmev_ns *ns);
+const char *conv_gc_policy_name(uint32_t policy);
+
 #endif
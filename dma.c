@@ -8,6 +8,8 @@
 #include <linux/init.h>
 #include <linux/sched/task.h>
 #include <linux/slab.h>
+#include <linux/io.h>
+#include <linux/workqueue.h>
 
 #include "dma.h"
 
@@ -75,12 +77,6 @@ static struct ioat_dma_info {
 	.lock = __MUTEX_INITIALIZER(test_info.lock),
 };
 
-struct ioat_dma_thread {
-	struct ioat_dma_info *info;
-	struct dma_chan *chan;
-	enum dma_transaction_type type;
-};
-
 struct ioat_dma_chan {
 	struct list_head node;
 	struct dma_chan *chan;
@@ -92,7 +88,26 @@ static char test_channel[CHANNEL_NAME_LEN];
 /* Maximum amount of mismatched bytes in buffer to print */
 #define MAX_ERROR_COUNT 32
 
-static struct ioat_dma_thread dma_thread;
+/* Descriptors are spread round-robin over every channel we got */
+#define NR_MAX_DMA_CHANS 16
+static struct dma_chan *dma_chans[NR_MAX_DMA_CHANS];
+static unsigned int nr_dma_chans;
+static unsigned int dma_chan_turn;
+
+/*
+ * Software stand-in for machines without a DMA engine. It runs the copies
+ * on an unbound workqueue and completes them through the same callbacks.
+ */
+static struct workqueue_struct *soft_dma_wq;
+
+struct soft_dma_req {
+	struct work_struct work;
+	dma_addr_t src_addr;
+	dma_addr_t dst_addr;
+	unsigned int size;
+	dma_async_tx_callback callback;
+	void *param;
+};
 
 static bool ioat_dma_match_channel(struct ioat_dma_params *params, struct dma_chan *chan)
 {
@@ -115,68 +130,121 @@ static void result(const char *err, unsigned int n, dma_addr_t src_addr, dma_add
 		 current->comm, n, err, src_addr, dst_addr, len, data);
 }
 
-int ioat_dma_submit(dma_addr_t src_addr, dma_addr_t dst_addr, unsigned int size)
+static void __soft_dma_copy(dma_addr_t src_addr, dma_addr_t dst_addr, unsigned int size)
+{
+	void *src = memremap(src_addr, size, MEMREMAP_WB);
+	void *dst = memremap(dst_addr, size, MEMREMAP_WB);
+
+	if (src && dst)
+		memcpy(dst, src, size);
+	else
+		result("map error", 1, src_addr, dst_addr, size, -ENOMEM);
+
+	if (src)
+		memunmap(src);
+	if (dst)
+		memunmap(dst);
+}
+
+static void soft_dma_work(struct work_struct *work)
 {
-	struct ioat_dma_thread *thread = &dma_thread;
-	struct ioat_dma_info *info;
+	struct soft_dma_req *req = container_of(work, struct soft_dma_req, work);
+
+	__soft_dma_copy(req->src_addr, req->dst_addr, req->size);
+	req->callback(req->param);
+	kfree(req);
+}
+
+/*
+ * Queue a copy of @size bytes and return without waiting for it. @callback
+ * is invoked with @param once the copy is done, possibly from softirq
+ * context. Nothing is started until ioat_dma_issue_pending() is called, so
+ * the descriptors of a command can be batched. If the engine refuses the
+ * descriptor, the copy is done synchronously before returning the error.
+ */
+int ioat_dma_submit(dma_addr_t src_addr, dma_addr_t dst_addr, unsigned int size,
+		    dma_async_tx_callback callback, void *param)
+{
+	struct dma_async_tx_descriptor *tx;
+	struct soft_dma_req *req;
 	struct dma_chan *chan;
-	struct dma_device *dev;
 	dma_cookie_t cookie;
-	enum dma_status status;
-	enum dma_ctrl_flags flags = DMA_CTRL_ACK; /* Always use polled mode */
-	int ret;
-	int i;
-	struct dma_async_tx_descriptor *tx = NULL;
-
-	set_freezable();
+	int ret = -ENOMEM;
 
 	pr_debug("START: 0x%llx -> 0x%llx, len: %d\n", src_addr, dst_addr, size);
 
-	ret = -ENOMEM;
-
-	smp_rmb();
-	info = thread->info;
-	chan = thread->chan;
-	dev = chan->device;
+	if (soft_dma_wq) {
+		req = kmalloc(sizeof(*req), GFP_KERNEL);
+		if (!req)
+			goto fallback;
+
+		INIT_WORK(&req->work, soft_dma_work);
+		req->src_addr = src_addr;
+		req->dst_addr = dst_addr;
+		req->size = size;
+		req->callback = callback;
+		req->param = param;
+		queue_work(soft_dma_wq, &req->work);
+		return 0;
+	}
 
-	/* thread->type is always DMA_MEMCPY */
-	tx = dev->device_prep_dma_memcpy(chan, dst_addr, src_addr, size, flags);
+	chan = dma_chans[dma_chan_turn++ % nr_dma_chans];
 
+	tx = chan->device->device_prep_dma_memcpy(chan, dst_addr, src_addr, size,
+						  DMA_CTRL_ACK | DMA_PREP_INTERRUPT);
 	if (!tx) {
 		result("prep error", 1, src_addr, dst_addr, size, ret);
-		msleep(100);
-		goto out;
+		goto fallback;
 	}
 
-	cookie = tx->tx_submit(tx);
+	tx->callback = callback;
+	tx->callback_param = param;
 
+	cookie = dmaengine_submit(tx);
 	if (dma_submit_error(cookie)) {
 		result("submit error", 1, src_addr, dst_addr, size, ret);
-		msleep(100);
-		goto out;
+		goto fallback;
 	}
 
-	/* Always use polled mode */
-	status = dma_sync_wait(chan, cookie);
-	dmaengine_terminate_sync(chan);
+	return 0;
+
+fallback:
+	__soft_dma_copy(src_addr, dst_addr, size);
+	callback(param);
+	return ret;
+}
 
-	if (status != DMA_COMPLETE &&
-	    !(dma_has_cap(DMA_COMPLETION_NO_ORDER, dev->cap_mask) && status == DMA_OUT_OF_ORDER)) {
-		result(status == DMA_ERROR ? "completion error status" : "completion busy status",
-		       1, src_addr, dst_addr, size, ret);
-		goto out;
-	}
+/* Kick every channel to start the descriptors submitted so far */
+void ioat_dma_issue_pending(void)
+{
+	unsigned int i;
 
-	ret = 0;
+	for (i = 0; i < nr_dma_chans; i++)
+		dma_async_issue_pending(dma_chans[i]);
+}
 
-out:
-	pr_debug("DONE: 0x%llx -> 0x%llx, len: %d\n", src_addr, dst_addr, size);
+/* Wait for every submitted copy to complete */
+void ioat_dma_flush(void)
+{
+	unsigned int i;
 
-	/* terminate all transfers on specified channels */
-	if (ret)
-		dmaengine_terminate_sync(chan);
+	if (soft_dma_wq) {
+		flush_workqueue(soft_dma_wq);
+		return;
+	}
 
-	return ret;
+	for (i = 0; i < nr_dma_chans; i++)
+		dma_sync_wait(dma_chans[i], dma_chans[i]->cookie);
+}
+
+int ioat_dma_soft_init(void)
+{
+	soft_dma_wq = alloc_workqueue("nvmev_dma", WQ_UNBOUND | WQ_HIGHPRI, 0);
+	if (!soft_dma_wq)
+		return -ENOMEM;
+
+	pr_info("Using the software DMA stand-in\n");
+	return 0;
 }
 
 static int ioat_dma_add_channel(struct ioat_dma_info *info, struct dma_chan *chan)
@@ -199,11 +267,9 @@ static int ioat_dma_add_channel(struct ioat_dma_info *info, struct dma_chan *cha
 		pr_warn("DMA_COMPLETION_NO_ORDER, polled disabled\n");
 	}
 
-	if (dma_has_cap(DMA_MEMCPY, dma_dev->cap_mask)) {
+	if (dma_has_cap(DMA_MEMCPY, dma_dev->cap_mask) && nr_dma_chans < NR_MAX_DMA_CHANS) {
 		pr_info("ioat_dma_add_threads\n");
-		dma_thread.info = info;
-		dma_thread.chan = dtc->chan;
-		dma_thread.type = DMA_MEMCPY;
+		dma_chans[nr_dma_chans++] = dtc->chan;
 	}
 
 	pr_info("Added %u threads using %s\n", thread_count, dma_chan_name(chan));
@@ -339,4 +405,10 @@ void ioat_dma_cleanup(void)
 	}
 
 	info->nr_channels = 0;
+	nr_dma_chans = 0;
+
+	if (soft_dma_wq) {
+		destroy_workqueue(soft_dma_wq);
+		soft_dma_wq = NULL;
+	}
 }
@@ -5,7 +5,11 @@
 
 // DMA Init, Final Function
 int ioat_dma_chan_set(const char *val);
-int ioat_dma_submit(dma_addr_t src_addr, dma_addr_t dst_addr, unsigned int size);
+int ioat_dma_soft_init(void);
+int ioat_dma_submit(dma_addr_t src_addr, dma_addr_t dst_addr, unsigned int size,
+		    dma_async_tx_callback callback, void *param);
+void ioat_dma_issue_pending(void);
+void ioat_dma_flush(void);
 void ioat_dma_cleanup(void);
 
 #endif /* _LIB_DMA_H */
@@ -4,10 +4,18 @@
 #include <linux/kthread.h>
 #include <linux/ktime.h>
 #include <linux/highmem.h>
+#include <linux/hrtimer.h>
+#include <linux/log2.h>
+#include <linux/perf_event.h>
+#include <linux/prefetch.h>
 #include <linux/sched/clock.h>
+#include <linux/sizes.h>
+#include <linux/vmalloc.h>
+#include <linux/timex.h>
 
 #include "nvmev.h"
 #include "dma.h"
+#include "nvmev_trace.h"
 
 #if (SUPPORTED_SSD_TYPE(CONV) || SUPPORTED_SSD_TYPE(ZNS))
 #include "ssd.h"
@@ -50,252 +58,640 @@ static inline size_t __cmd_io_size(struct nvme_rw_command *cmd)
 	return (cmd->length + 1) << LBA_BITS;
 }
 
-static unsigned int __do_perform_io(int sqid, int sq_entry)
+/*
+ * Copy kernels for the storage. NOCACHE writes the storage with non-temporal
+ * stores, so data that are only read back much later do not evict the host's
+ * working set from LLC. PREFETCH reads the storage a chunk ahead of the copy.
+ */
+#define NVMEV_PREFETCH_CHUNK 1024
+
+static void __memcpy_prefetch(void *dst, const void *src, size_t len)
 {
-//	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[sqid];
-	struct nvme_rw_command *cmd = &sq_entry(sq_entry).rw;
-	size_t offset;
-	size_t length, remaining;
-	int prp_offs = 0;
-	int prp2_offs = 0;
-	u64 paddr;
-	u64 *paddr_list = NULL;
-	size_t nsid = cmd->nsid - 1; // 0-based
-	bool is_paddr_memremap = false;
+	while (len) {
+		size_t chunk = min_t(size_t, len, NVMEV_PREFETCH_CHUNK);
 
-	offset = __cmd_io_offset(cmd);
-	length = __cmd_io_size(cmd);
-	remaining = length;
+		if (len > chunk)
+			prefetch_range((void *)src + chunk,
+				       min_t(size_t, len - chunk, NVMEV_PREFETCH_CHUNK));
+		memcpy(dst, src, chunk);
 
-	while (remaining) {
-		size_t io_size;
-		void *vaddr;
-		size_t mem_offs = 0;
-		bool is_vaddr_memremap = false;
-
-		prp_offs++;
-		if (prp_offs == 1) {
-			paddr = cmd->prp1;
-		} else if (prp_offs == 2) {
-			paddr = cmd->prp2;
-			if (remaining > PAGE_SIZE) {
-				if (pfn_valid(paddr >> PAGE_SHIFT)) {
-					paddr_list = kmap_atomic_pfn(PRP_PFN(paddr)) +
-						(paddr & PAGE_OFFSET_MASK);
-				} else {
-					paddr_list = memremap(paddr, PAGE_SIZE, MEMREMAP_WT);
-					paddr_list += (paddr & PAGE_OFFSET_MASK);
-					is_paddr_memremap = true;
-				}
-				paddr = paddr_list[prp2_offs++];
+		dst += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+}
+
+static void __copy_data(void *dev, void *host, size_t len, bool to_dev, unsigned int copy_mode)
+{
+	if (copy_mode & NVMEV_COPY_ZERO) {
+		memset(host, 0, len);
+	} else if (to_dev) {
+		if (copy_mode & NVMEV_COPY_NOCACHE)
+			memcpy_flushcache(dev, host, len);
+		else
+			memcpy(dev, host, len);
+	} else {
+		if (copy_mode & NVMEV_COPY_PREFETCH)
+			__memcpy_prefetch(host, dev, len);
+		else
+			memcpy(host, dev, len);
+	}
+}
+
+/*
+ * Copy @len bytes between the storage at @dev and the physically contiguous
+ * host memory at @paddr. Lowmem goes through the direct map and memory
+ * outside of the kernel's view through a single memremap; highmem still needs
+ * a temporary mapping per page.
+ */
+static void __copy_prp_run(void *dev, u64 paddr, size_t len, bool to_dev, unsigned int copy_mode)
+{
+	unsigned long pfn = PRP_PFN(paddr);
+	unsigned long last_pfn = PRP_PFN(paddr + len - 1);
+	void *vaddr;
+
+	if (!pfn_valid(pfn)) {
+		vaddr = memremap(paddr, len, MEMREMAP_WT);
+		__copy_data(dev, vaddr, len, to_dev, copy_mode);
+		memunmap(vaddr);
+		return;
+	}
+
+	if (pfn_valid(last_pfn) && !PageHighMem(pfn_to_page(last_pfn))) {
+		__copy_data(dev, phys_to_virt(paddr), len, to_dev, copy_mode);
+		return;
+	}
+
+	while (len) {
+		size_t mem_offs = paddr & PAGE_OFFSET_MASK;
+		size_t io_size = min_t(size_t, len, PAGE_SIZE - mem_offs);
+
+		vaddr = kmap_atomic_pfn(PRP_PFN(paddr));
+		__copy_data(dev, vaddr + mem_offs, io_size, to_dev, copy_mode);
+		kunmap_atomic(vaddr);
+
+		dev += io_size;
+		paddr += io_size;
+		len -= io_size;
+	}
+}
+
+void nvmev_dptr_init(struct nvmev_dptr_iter *it, u8 flags, u64 dptr1, u64 dptr2, size_t length)
+{
+	memset(it, 0, offsetof(struct nvmev_dptr_iter, descs));
+	it->remaining = length;
+	it->is_sgl = !!(flags & NVME_CMD_SGL_ALL);
+	it->status = NVME_SC_SUCCESS;
+
+	if (!it->is_sgl) {
+		it->prp1 = dptr1;
+		it->prp2 = dptr2;
+		return;
+	}
+
+	/* The first descriptor is inlined in the command */
+	it->descs[0].addr = dptr1;
+	it->descs[0].length = lower_32_bits(dptr2);
+	it->descs[0].type = dptr2 >> 56;
+	it->nr_descs = 1;
+	it->desc_idx = 0;
+	it->seg_left = 0;
+	it->nr_segs = 0;
+	it->is_last_seg = false;
+}
+
+static void __dptr_map_prp_list(struct nvmev_dptr_iter *it)
+{
+	if (pfn_valid(PRP_PFN(it->prp2))) {
+		it->prp_list = kmap_atomic_pfn(PRP_PFN(it->prp2)) + (it->prp2 & PAGE_OFFSET_MASK);
+		it->is_prp_list_memremap = false;
+	} else {
+		it->prp_list = memremap(it->prp2 & PAGE_MASK, PAGE_SIZE, MEMREMAP_WT);
+		it->prp_list += (it->prp2 & PAGE_OFFSET_MASK) / sizeof(u64);
+		it->is_prp_list_memremap = true;
+	}
+}
+
+static bool __dptr_next_prp(struct nvmev_dptr_iter *it, u64 *paddr)
+{
+	it->nr_prps++;
+	if (it->nr_prps == 1) {
+		*paddr = it->prp1;
+	} else if (it->nr_prps == 2) {
+		*paddr = it->prp2;
+		if (it->remaining > PAGE_SIZE) {
+			__dptr_map_prp_list(it);
+			*paddr = it->prp_list[0];
+		}
+	} else {
+		/* The list was unmapped by nvmev_dptr_end() in between */
+		if (!it->prp_list)
+			__dptr_map_prp_list(it);
+		*paddr = it->prp_list[it->nr_prps - 2];
+	}
+
+	return true;
+}
+
+static bool __dptr_next_sgl(struct nvmev_dptr_iter *it, u64 *paddr, size_t *len)
+{
+	while (true) {
+		struct nvme_sgl_desc *desc;
+		unsigned int nr;
+
+		if (it->desc_idx == it->nr_descs) {
+			if (it->seg_left == 0) {
+				/* The SGL describes less than the command transfers */
+				it->status = NVME_SC_SGL_INVALID_DATA;
+				return false;
 			}
-		} else {
-			paddr = paddr_list[prp2_offs++];
+
+			nr = min_t(unsigned int, it->seg_left, NR_SGL_DESCS_BATCH);
+			__copy_prp_run(it->descs, it->seg_addr, nr * sizeof(*desc), true,
+				       NVMEV_COPY_MEMCPY);
+			it->seg_addr += nr * sizeof(*desc);
+			it->seg_left -= nr;
+			it->nr_descs = nr;
+			it->desc_idx = 0;
 		}
 
-		if (pfn_valid(paddr >> PAGE_SHIFT)) {
-			vaddr = kmap_atomic_pfn(PRP_PFN(paddr));
-		} else {
-			vaddr = memremap(paddr, PAGE_SIZE, MEMREMAP_WT);
-			is_vaddr_memremap = true;
+		desc = &it->descs[it->desc_idx++];
+
+		if ((desc->type & 0xf) != NVME_SGL_FMT_ADDRESS) {
+			it->status = NVME_SC_SGL_INVALID_TYPE;
+			return false;
 		}
 
-		io_size = min_t(size_t, remaining, PAGE_SIZE);
+		switch (desc->type >> 4) {
+		case NVME_SGL_FMT_DATA_DESC:
+			if (desc->length == 0)
+				continue;
+
+			*paddr = desc->addr;
+			*len = min_t(size_t, it->remaining, desc->length);
+			return true;
 
-		if (paddr & PAGE_OFFSET_MASK) {
-			mem_offs = paddr & PAGE_OFFSET_MASK;
-			if (io_size + mem_offs > PAGE_SIZE)
-				io_size = PAGE_SIZE - mem_offs;
+		case NVME_SGL_FMT_SEG_DESC:
+		case NVME_SGL_FMT_LAST_SEG_DESC:
+			/* Only the last descriptor of a non-last segment may chain */
+			if (it->is_last_seg || it->desc_idx != it->nr_descs || it->seg_left != 0) {
+				it->status = NVME_SC_SGL_INVALID_LAST;
+				return false;
+			}
+			if (desc->length == 0 || desc->length % sizeof(*desc) != 0 ||
+			    ++it->nr_segs > NR_MAX_SGL_SEGS) {
+				it->status = NVME_SC_SGL_INVALID_COUNT;
+				return false;
+			}
+
+			it->seg_addr = desc->addr;
+			it->seg_left = desc->length / sizeof(*desc);
+			it->is_last_seg = (desc->type >> 4) == NVME_SGL_FMT_LAST_SEG_DESC;
+			it->nr_descs = it->desc_idx = 0;
+			continue;
+
+		default:
+			it->status = NVME_SC_SGL_INVALID_TYPE;
+			return false;
 		}
-		//向虚拟的存储设备写入数据
-		if (cmd->opcode == nvme_cmd_write ||
-		    cmd->opcode == nvme_cmd_zone_append) {
-			memcpy(nvmev_vdev->ns[nsid].mapped + offset, vaddr + mem_offs, io_size);
-		} else if (cmd->opcode == nvme_cmd_read) {
-			memcpy(vaddr + mem_offs, nvmev_vdev->ns[nsid].mapped + offset, io_size);
+	}
+}
+
+/*
+ * Return the next physically contiguous chunk of the data buffer in @paddr
+ * and @len. Returns false when the whole length has been walked or the data
+ * pointer is malformed, in which case @it->status tells why.
+ */
+bool nvmev_dptr_next(struct nvmev_dptr_iter *it, u64 *paddr, size_t *len)
+{
+	if (!it->remaining || it->status != NVME_SC_SUCCESS)
+		return false;
+
+	if (it->is_sgl) {
+		if (!__dptr_next_sgl(it, paddr, len))
+			return false;
+	} else {
+		__dptr_next_prp(it, paddr);
+		*len = min_t(size_t, it->remaining, PAGE_SIZE - (*paddr & PAGE_OFFSET_MASK));
+	}
+
+	it->remaining -= *len;
+	return true;
+}
+
+/*
+ * Release the mapping of the PRP list, if any. The walk may go on afterwards;
+ * the list is mapped again when needed, so callers can sleep in between.
+ */
+void nvmev_dptr_end(struct nvmev_dptr_iter *it)
+{
+	if (!it->prp_list)
+		return;
+
+	if (it->is_prp_list_memremap)
+		memunmap((void *)((unsigned long)it->prp_list & PAGE_MASK));
+	else
+		kunmap_atomic(it->prp_list);
+	it->prp_list = NULL;
+}
+
+/*
+ * Copy @length bytes between @buf and the data buffer of a command. Chunks
+ * that are physically contiguous are merged and copied at once.
+ */
+u16 nvmev_dptr_copy(u8 flags, u64 dptr1, u64 dptr2, void *buf, size_t length, bool to_dev,
+		    unsigned int copy_mode)
+{
+	struct nvmev_dptr_iter it;
+	u64 paddr, run_paddr = 0;
+	size_t len, run_len = 0;
+
+	nvmev_dptr_init(&it, flags, dptr1, dptr2, length);
+
+	while (nvmev_dptr_next(&it, &paddr, &len)) {
+		if (run_len && paddr == run_paddr + run_len) {
+			run_len += len;
+			continue;
 		}
 
-		if (vaddr != NULL && !is_vaddr_memremap) {
-			kunmap_atomic(vaddr);
-			vaddr = NULL;
-		} else if (vaddr != NULL && is_vaddr_memremap) {
-			memunmap(vaddr);
-			vaddr = NULL;
-			is_vaddr_memremap = false;
+		if (run_len) {
+			__copy_prp_run(buf, run_paddr, run_len, to_dev, copy_mode);
+			buf += run_len;
 		}
+		run_paddr = paddr;
+		run_len = len;
+	}
+
+	if (run_len && it.status == NVME_SC_SUCCESS)
+		__copy_prp_run(buf, run_paddr, run_len, to_dev, copy_mode);
+
+	/* Non-temporal stores are weakly ordered against the completion */
+	if (to_dev && (copy_mode & NVMEV_COPY_NOCACHE))
+		wmb();
+
+	nvmev_dptr_end(&it);
+	return it.status;
+}
+
+/*
+ * Make [@offset, @offset + @len) of @ns read as zeroes. Whole granules are
+ * only marked in the zero bitmap; the rest is cleared right away.
+ */
+void nvmev_zero_range(struct nvmev_ns *ns, u64 offset, u64 len)
+{
+	u64 end = offset + len;
+	u64 first = round_up(offset, NVMEV_ZERO_SIZE);
+	u64 last = round_down(end, NVMEV_ZERO_SIZE);
 
-		remaining -= io_size;
-		offset += io_size;
+	if (!ns->zero_bitmap || first >= last) {
+		memset(ns->mapped + offset, 0, len);
+		return;
 	}
 
-	if (paddr_list) {
-		if (!is_paddr_memremap) 
-			kunmap_atomic(paddr_list);
-		else if (is_paddr_memremap) 
-			memunmap(paddr_list);
+	memset(ns->mapped + offset, 0, first - offset);
+	memset(ns->mapped + last, 0, end - last);
+
+	spin_lock(&ns->zero_lock);
+	bitmap_set(ns->zero_bitmap, first >> NVMEV_ZERO_SHIFT, (last - first) >> NVMEV_ZERO_SHIFT);
+	spin_unlock(&ns->zero_lock);
+}
+
+static inline bool __has_zeroes(struct nvmev_ns *ns, u64 offset, u64 len)
+{
+	unsigned long last = (offset + len - 1) >> NVMEV_ZERO_SHIFT;
+
+	return ns->zero_bitmap &&
+	       find_next_bit(ns->zero_bitmap, last + 1, offset >> NVMEV_ZERO_SHIFT) <= last;
+}
+
+/*
+ * Called before data are written to [@offset, @offset + @len). Granules that
+ * are about to be partially written get their zeroes for real.
+ */
+static void __unzero_range(struct nvmev_ns *ns, u64 offset, u64 len)
+{
+	unsigned long first = offset >> NVMEV_ZERO_SHIFT;
+	unsigned long last = (offset + len - 1) >> NVMEV_ZERO_SHIFT;
+	u64 end = offset + len;
+
+	if (!__has_zeroes(ns, offset, len))
+		return;
+
+	spin_lock(&ns->zero_lock);
+	if (test_bit(first, ns->zero_bitmap) && (offset & (NVMEV_ZERO_SIZE - 1)))
+		memset(ns->mapped + round_down(offset, NVMEV_ZERO_SIZE), 0,
+		       offset & (NVMEV_ZERO_SIZE - 1));
+	if (test_bit(last, ns->zero_bitmap) && (end & (NVMEV_ZERO_SIZE - 1)))
+		memset(ns->mapped + end, 0, round_up(end, NVMEV_ZERO_SIZE) - end);
+	bitmap_clear(ns->zero_bitmap, first, last - first + 1);
+	spin_unlock(&ns->zero_lock);
+}
+
+/*
+ * Move [@src, @src + @len) of @ns to @dst for the Copy command. Zero granules
+ * of the source stay zero granules at the destination.
+ */
+void nvmev_move_range(struct nvmev_ns *ns, u64 dst, u64 src, u64 len)
+{
+	if (!__has_zeroes(ns, src, len)) {
+		__unzero_range(ns, dst, len);
+		memmove(ns->mapped + dst, ns->mapped + src, len);
+		return;
 	}
-	paddr_list = NULL;
 
-	return length;
+	while (len) {
+		unsigned long bit = src >> NVMEV_ZERO_SHIFT;
+		bool zero = test_bit(bit, ns->zero_bitmap);
+		unsigned long next = zero ? find_next_zero_bit(ns->zero_bitmap, ns->nr_zero_bits, bit) :
+					    find_next_bit(ns->zero_bitmap, ns->nr_zero_bits, bit);
+		u64 chunk = min_t(u64, len, ((u64)next << NVMEV_ZERO_SHIFT) - src);
+
+		if (zero) {
+			nvmev_zero_range(ns, dst, chunk);
+		} else {
+			__unzero_range(ns, dst, chunk);
+			memmove(ns->mapped + dst, ns->mapped + src, chunk);
+		}
+
+		dst += chunk;
+		src += chunk;
+		len -= chunk;
+	}
 }
 
-static u64 paddr_list[513] = {
-	0,
-}; // Not using index 0 to make max index == num_prp
-static unsigned int __do_perform_io_using_dma(int sqid, int sq_entry)
+/* Read that covers zero granules; they are filled instead of copied */
+static u16 __do_perform_zero_read(struct nvmev_ns *ns, struct nvme_rw_command *cmd)
+{
+	struct nvmev_dptr_iter it;
+	u64 offset = __cmd_io_offset(cmd);
+	u64 paddr;
+	size_t len;
+
+	nvmev_dptr_init(&it, cmd->flags, cmd->prp1, cmd->prp2, __cmd_io_size(cmd));
+
+	while (nvmev_dptr_next(&it, &paddr, &len)) {
+		while (len) {
+			unsigned long bit = offset >> NVMEV_ZERO_SHIFT;
+			bool zero = test_bit(bit, ns->zero_bitmap);
+			unsigned long next = zero ? find_next_zero_bit(ns->zero_bitmap, ns->nr_zero_bits, bit) :
+						    find_next_bit(ns->zero_bitmap, ns->nr_zero_bits, bit);
+			size_t chunk = min_t(u64, len, ((u64)next << NVMEV_ZERO_SHIFT) - offset);
+
+			__copy_prp_run(ns->mapped + offset, paddr, chunk, false,
+				       zero ? NVMEV_COPY_ZERO : ns->copy_mode);
+
+			offset += chunk;
+			paddr += chunk;
+			len -= chunk;
+		}
+	}
+
+	nvmev_dptr_end(&it);
+	return it.status;
+}
+
+static u16 __do_perform_io(int sqid, int sq_entry)
 {
 //	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[sqid];
 	struct nvme_rw_command *cmd = &sq_entry(sq_entry).rw;
-	size_t offset;
-	size_t length, remaining;
-	int prp_offs = 0;
-	int prp2_offs = 0;
-	int num_prps = 0;
-	u64 paddr;
-	u64 *tmp_paddr_list = NULL;
-	size_t io_size;
-	size_t mem_offs = 0;
-	bool is_memremap = false;
-
-	offset = __cmd_io_offset(cmd);
-	length = __cmd_io_size(cmd);
-	remaining = length;
-
-	memset(paddr_list, 0, sizeof(paddr_list));
-	/* Loop to get the PRP list */
-	while (remaining) {
-		io_size = 0;
-
-		prp_offs++;
-		if (prp_offs == 1) {
-			paddr_list[prp_offs] = cmd->prp1;
-		} else if (prp_offs == 2) {
-			paddr_list[prp_offs] = cmd->prp2;
-			if (remaining > PAGE_SIZE) {
-				if (pfn_valid(paddr_list[prp_offs] >> PAGE_SHIFT)) {
- 					tmp_paddr_list = kmap_atomic_pfn(PRP_PFN(paddr_list[prp_offs])) + 
-							(paddr_list[prp_offs] & PAGE_OFFSET_MASK);
- 				} else {
- 					tmp_paddr_list = memremap(paddr_list[prp_offs], PAGE_SIZE, MEMREMAP_WT);
- 					tmp_paddr_list += (paddr_list[prp_offs] & PAGE_OFFSET_MASK);
- 					is_memremap = true;
- 				}
-				paddr_list[prp_offs] = tmp_paddr_list[prp2_offs++];
-			}
-		} else {
-			paddr_list[prp_offs] = tmp_paddr_list[prp2_offs++];
-		}
+	size_t nsid = cmd->nsid - 1; // 0-based
+	struct nvmev_ns *ns = &nvmev_vdev->ns[nsid];
+	bool to_dev = (cmd->opcode == nvme_cmd_write || cmd->opcode == nvme_cmd_zone_append);
 
-		io_size = min_t(size_t, remaining, PAGE_SIZE);
+	if (!to_dev && cmd->opcode != nvme_cmd_read)
+		return NVME_SC_SUCCESS;
 
-		if (paddr_list[prp_offs] & PAGE_OFFSET_MASK) {
-			mem_offs = paddr_list[prp_offs] & PAGE_OFFSET_MASK;
-			if (io_size + mem_offs > PAGE_SIZE)
-				io_size = PAGE_SIZE - mem_offs;
-		}
+	if (to_dev)
+		__unzero_range(ns, __cmd_io_offset(cmd), __cmd_io_size(cmd));
+	else if (__has_zeroes(ns, __cmd_io_offset(cmd), __cmd_io_size(cmd)))
+		return __do_perform_zero_read(ns, cmd);
 
-		remaining -= io_size;
-	}
-	num_prps = prp_offs;
+	//向虚拟的存储设备写入数据
+	return nvmev_dptr_copy(cmd->flags, cmd->prp1, cmd->prp2, ns->mapped + __cmd_io_offset(cmd),
+			       __cmd_io_size(cmd), to_dev, ns->copy_mode);
+}
+
+static void __dma_copy_done(void *param)
+{
+	struct nvmev_io_work *w = param;
 
-	if (tmp_paddr_list != NULL && !is_memremap) {
- 		kunmap_atomic(tmp_paddr_list);
- 	} else if (tmp_paddr_list != NULL && is_memremap) {
- 		memunmap(tmp_paddr_list);
- 		is_memremap = false;
- 	}
+	if (atomic_dec_and_test(&w->nr_dma_pending))
+		smp_store_release(&w->is_copied, true);
+}
 
-	remaining = length;
-	prp_offs = 1;
+#define NR_DMA_RUNS_BATCH 16
 
-	/* Loop for data transfer */
-	while (remaining) {
-		size_t page_size;
-		mem_offs = 0;
-		io_size = 0;
-		page_size = 0;
+/*
+ * Start copying the data of @w over the DMA engine without waiting for it.
+ * @w->is_copied is set when the last of its copies completes.
+ */
+static u16 __do_perform_io_using_dma(struct nvmev_io_work *w)
+{
+//	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
+	int sq_entry = w->sq_entry;
+	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[w->sqid];
+	struct nvme_rw_command *cmd = &sq_entry(sq_entry).rw;
+	struct nvmev_ns *ns = &nvmev_vdev->ns[cmd->nsid - 1];
+	struct nvmev_dptr_iter it;
+	struct {
+		u64 paddr;
+		size_t len;
+	} runs[NR_DMA_RUNS_BATCH];
+	unsigned int nr_runs = 0, i;
+	size_t offset = __cmd_io_offset(cmd);
+	u64 paddr, run_paddr = 0;
+	size_t len, run_len = 0;
+	bool done;
+
+	if (cmd->opcode == nvme_cmd_write || cmd->opcode == nvme_cmd_zone_append) {
+		__unzero_range(ns, offset, __cmd_io_size(cmd));
+	} else if (cmd->opcode == nvme_cmd_read && __has_zeroes(ns, offset, __cmd_io_size(cmd))) {
+		/* Nothing to move for zeroes; do it on the CPU */
+		u16 status = __do_perform_zero_read(ns, cmd);
+
+		smp_store_release(&w->is_copied, true);
+		return status;
+	}
 
-		paddr = paddr_list[prp_offs];
-		page_size = min_t(size_t, remaining, PAGE_SIZE);
+	nvmev_dptr_init(&it, cmd->flags, cmd->prp1, cmd->prp2, __cmd_io_size(cmd));
+	atomic_set(&w->nr_dma_pending, 1);
 
-		/* For non-page aligned paddr, it will never be between continuous PRP list (Always first paddr)  */
-		if (paddr & PAGE_OFFSET_MASK) {
-			mem_offs = paddr & PAGE_OFFSET_MASK;
-			if (page_size + mem_offs > PAGE_SIZE) {
-				page_size = PAGE_SIZE - mem_offs;
-			}
+	/*
+	 * Submit one DMA per physically contiguous run and start them at once.
+	 * Submitting may sleep, so the runs are gathered in batches and the PRP
+	 * list is unmapped before each batch goes out.
+	 */
+	do {
+		done = !nvmev_dptr_next(&it, &paddr, &len);
+		if (!done && run_len && paddr == run_paddr + run_len) {
+			run_len += len;
+			continue;
 		}
 
-		for (prp_offs++; prp_offs <= num_prps; prp_offs++) {
-			if (paddr_list[prp_offs] == paddr_list[prp_offs - 1] + PAGE_SIZE)
-				page_size += PAGE_SIZE;
-			else
-				break;
+		if (run_len && it.status == NVME_SC_SUCCESS) {
+			runs[nr_runs].paddr = run_paddr;
+			runs[nr_runs].len = run_len;
+			nr_runs++;
 		}
+		run_paddr = paddr;
+		run_len = len;
 
-		io_size = min_t(size_t, remaining, page_size);
+		if (nr_runs < NR_DMA_RUNS_BATCH && !done)
+			continue;
 
-		if (cmd->opcode == nvme_cmd_write ||
-		    cmd->opcode == nvme_cmd_zone_append) {
-			ioat_dma_submit(paddr, nvmev_vdev->config.storage_start + offset, io_size);
-		} else if (cmd->opcode == nvme_cmd_read) {
-			ioat_dma_submit(nvmev_vdev->config.storage_start + offset, paddr, io_size);
+		nvmev_dptr_end(&it);
+		for (i = 0; i < nr_runs; i++) {
+			if (cmd->opcode == nvme_cmd_write ||
+			    cmd->opcode == nvme_cmd_zone_append) {
+				atomic_inc(&w->nr_dma_pending);
+				ioat_dma_submit(runs[i].paddr, nvmev_vdev->config.storage_start + offset,
+						runs[i].len, __dma_copy_done, w);
+			} else if (cmd->opcode == nvme_cmd_read) {
+				atomic_inc(&w->nr_dma_pending);
+				ioat_dma_submit(nvmev_vdev->config.storage_start + offset, runs[i].paddr,
+						runs[i].len, __dma_copy_done, w);
+			}
+			offset += runs[i].len;
 		}
+		nr_runs = 0;
+	} while (!done);
+
+	ioat_dma_issue_pending();
+	__dma_copy_done(w);
+
+	return it.status;
+}
 
-		remaining -= io_size;
-		offset += io_size;
+/*
+ * Single-producer/single-consumer ring of @work_queue indexes. @head is only
+ * written by the consumer and @tail only by the producer, so each side keeps
+ * its own cache line and no lock is needed. Each side also caches the other
+ * side's index and looks at its cache line again only when it runs out.
+ *
+ * The producer may stage several entries and publish them at once.
+ */
+static bool __ring_stage(struct nvmev_io_ring *ring, unsigned int entry)
+{
+	if (ring->tail_staged - ring->head_cached == ring->size) {
+		ring->head_cached = smp_load_acquire(&ring->head);
+		if (ring->tail_staged - ring->head_cached == ring->size)
+			return false;
 	}
 
-	return length;
+	ring->entries[ring->tail_staged++ & (ring->size - 1)] = entry;
+	return true;
 }
 
-static void __insert_req_sorted(unsigned int entry, struct nvmev_io_worker *worker,
-				unsigned long nsecs_target)
+static void __ring_publish(struct nvmev_io_ring *ring)
 {
-//	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	/**
-	 * Requests are placed in @work_queue sorted by their target time.
-	 * @work_queue is statically allocated and the ordered list is
-	 * implemented by chaining the indexes of entries with @prev and @next.
-	 * This implementation is nasty but we do this way over dynamically
-	 * allocated linked list to minimize the influence of dynamic memory allocation.
-	 * Also, this O(n) implementation can be improved to O(logn) scheme with
-	 * e.g., red-black tree but....
-	 */
-	if (worker->io_seq == -1) {
-		worker->io_seq = entry;
-		worker->io_seq_end = entry;
-	} else {
-		unsigned int curr = worker->io_seq_end;
+	/* Publish the staged entries and what they point to */
+	if (ring->tail != ring->tail_staged)
+		smp_store_release(&ring->tail, ring->tail_staged);
+}
 
-		while (curr != -1) {
-			if (worker->work_queue[curr].nsecs_target <= worker->latest_nsecs)
-				break;
+static bool __ring_push(struct nvmev_io_ring *ring, unsigned int entry)
+{
+	if (!__ring_stage(ring, entry))
+		return false;
 
-			if (worker->work_queue[curr].nsecs_target <= nsecs_target)
-				break;
+	__ring_publish(ring);
+	return true;
+}
 
-			curr = worker->work_queue[curr].prev;
-		}
+static bool __ring_pop(struct nvmev_io_ring *ring, unsigned int *entry)
+{
+	unsigned int head = ring->head;
 
-		if (curr == -1) { /* Head inserted */
-			worker->work_queue[worker->io_seq].prev = entry;
-			worker->work_queue[entry].next = worker->io_seq;
-			worker->io_seq = entry;
-		} else if (worker->work_queue[curr].next == -1) { /* Tail */
-			worker->work_queue[entry].prev = curr;
-			worker->io_seq_end = entry;
-			worker->work_queue[curr].next = entry;
-		} else { /* In between */
-			worker->work_queue[entry].prev = curr;
-			worker->work_queue[entry].next = worker->work_queue[curr].next;
-
-			worker->work_queue[worker->work_queue[entry].next].prev = entry;
-			worker->work_queue[curr].next = entry;
-		}
+	if (head == ring->tail_cached) {
+		ring->tail_cached = smp_load_acquire(&ring->tail);
+		if (head == ring->tail_cached)
+			return false;
+	}
+
+	*entry = ring->entries[head & (ring->size - 1)];
+	smp_store_release(&ring->head, head + 1);
+	return true;
+}
+
+static inline bool __ring_empty(struct nvmev_io_ring *ring)
+{
+	return READ_ONCE(ring->head) == smp_load_acquire(&ring->tail);
+}
+
+static bool __ring_init(struct nvmev_io_ring *ring, unsigned int nr_entries)
+{
+	ring->head = ring->tail_cached = 0;
+	ring->tail = ring->tail_staged = ring->head_cached = 0;
+	ring->size = roundup_pow_of_two(nr_entries);
+	ring->entries = kcalloc(ring->size, sizeof(*ring->entries), GFP_KERNEL);
+
+	return ring->entries != NULL;
+}
+
+/*
+ * Requests in flight are kept in a binary min-heap of @work_queue indexes
+ * keyed by nsecs_target, so that both the insertion and the pop of the
+ * earliest request are O(log n). The heap is private to the worker.
+ * @work_queue stays statically allocated to minimize the influence of
+ * dynamic memory allocation.
+ */
+static void __heap_push(struct nvmev_io_worker *worker, unsigned int entry)
+{
+	unsigned int *heap = worker->heap;
+	unsigned long long nsecs_target = worker->work_queue[entry].nsecs_target;
+	unsigned int i = worker->nr_heap++;
+
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+
+		if (worker->work_queue[heap[parent]].nsecs_target <= nsecs_target)
+			break;
+
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = entry;
+}
+
+static unsigned int __heap_pop(struct nvmev_io_worker *worker)
+{
+	unsigned int *heap = worker->heap;
+	unsigned int top = heap[0];
+	unsigned int last = heap[--worker->nr_heap];
+	unsigned long long nsecs_target = worker->work_queue[last].nsecs_target;
+	unsigned int i = 0;
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < worker->nr_heap) {
+		if (child + 1 < worker->nr_heap &&
+		    worker->work_queue[heap[child + 1]].nsecs_target <
+			    worker->work_queue[heap[child]].nsecs_target)
+			child++;
+
+		if (nsecs_target <= worker->work_queue[heap[child]].nsecs_target)
+			break;
+
+		heap[i] = heap[child];
+		i = child;
 	}
+	heap[i] = last;
+
+	return top;
+}
+
+/*
+ * SQs are sharded over the dispatchers, so the dispatcher running on behalf
+ * of @sqid is the only producer of its submit ring towards each worker.
+ */
+static inline unsigned int __get_dispatcher(int sqid)
+{
+	return (sqid - 1) % nvmev_vdev->config.nr_dispatchers;
+}
+
+static inline unsigned int __get_entry_owner(struct nvmev_io_worker *worker, unsigned int entry)
+{
+	return entry / worker->nr_entries_per_dispatcher;
 }
 
 static struct nvmev_io_worker *__allocate_work_queue_entry(int sqid, unsigned int *entry)
@@ -303,10 +699,8 @@ static struct nvmev_io_worker *__allocate_work_queue_entry(int sqid, unsigned in
 //	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	unsigned int io_worker_turn = __get_io_worker(sqid);
 	struct nvmev_io_worker *worker = &nvmev_vdev->io_workers[io_worker_turn];
-	unsigned int e = worker->free_seq;
-	struct nvmev_io_work *w = worker->work_queue + e;
 
-	if (w->next >= NR_MAX_PARALLEL_IO) {
+	if (!__ring_pop(&worker->free_rings[__get_dispatcher(sqid)], entry)) {
 		WARN_ON_ONCE("IO queue is almost full");
 		return NULL;
 	}
@@ -315,18 +709,25 @@ static struct nvmev_io_worker *__allocate_work_queue_entry(int sqid, unsigned in
 		io_worker_turn = 0;
 	nvmev_vdev->io_worker_turn = io_worker_turn;
 
-	worker->free_seq = w->next;
-	BUG_ON(worker->free_seq >= NR_MAX_PARALLEL_IO);
-	*entry = e;
-
 	return worker;
 }
 
-static void __enqueue_io_req(int sqid, int cqid, int sq_entry, unsigned long long nsecs_start,
-			     struct nvmev_result *ret)
+static void __submit_work_queue_entry(struct nvmev_io_worker *worker, int sqid, unsigned int entry)
+{
+	/* Sized to hold every entry the dispatcher owns, so this never fails */
+	BUG_ON(!__ring_push(&worker->submit_rings[__get_dispatcher(sqid)], entry));
+
+	if (nvmev_vdev->config.worker_sleep) {
+		smp_mb(); /* Pairs with smp_store_mb() in __io_worker_sleep() */
+		if (READ_ONCE(worker->sleeping))
+			wake_up_process(worker->task_struct);
+	}
+}
+
+static void __enqueue_io_req(struct nvmev_submission_queue *sq, int sqid, int cqid, int sq_entry,
+			     unsigned long long nsecs_start, struct nvmev_result *ret)
 {
 //	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[sqid];
 	struct nvmev_io_worker *worker;
 	struct nvmev_io_work *w;
 	unsigned int entry;
@@ -350,15 +751,11 @@ static void __enqueue_io_req(int sqid, int cqid, int sq_entry, unsigned long lon
 	w->nsecs_enqueue = local_clock();
 	w->nsecs_target = ret->nsecs_target;
 	w->status = ret->status;
-	w->is_completed = false;
 	w->is_copied = false;
-	w->prev = -1;
-	w->next = -1;
 
 	w->is_internal = false;
-	mb(); /* IO worker shall see the updated w at once */
 
-	__insert_req_sorted(entry, worker, ret->nsecs_target);
+	__submit_work_queue_entry(worker, sqid, entry);
 }
 
 void schedule_internal_operation(int sqid, unsigned long long nsecs_target,
@@ -382,75 +779,19 @@ void schedule_internal_operation(int sqid, unsigned long long nsecs_target,
 	w->sqid = sqid;
 	w->nsecs_start = w->nsecs_enqueue = local_clock();
 	w->nsecs_target = nsecs_target;
-	w->is_completed = false;
 	w->is_copied = true;
-	w->prev = -1;
-	w->next = -1;
 
 	w->is_internal = true;
 	w->write_buffer = write_buffer;
 	w->buffs_to_release = buffs_to_release;
-	mb(); /* IO worker shall see the updated w at once */
-
-	__insert_req_sorted(entry, worker, nsecs_target);
-}
-
-static void __reclaim_completed_reqs(void)
-{
-//	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	unsigned int turn;
-
-	for (turn = 0; turn < nvmev_vdev->config.nr_io_workers; turn++) {
-		struct nvmev_io_worker *worker;
-		struct nvmev_io_work *w;
-
-		unsigned int first_entry = -1;
-		unsigned int last_entry = -1;
-		unsigned int curr;
-		int nr_reclaimed = 0;
-
-		worker = &nvmev_vdev->io_workers[turn];
-
-		first_entry = worker->io_seq;
-		curr = first_entry;
 
-		while (curr != -1) {
-			w = &worker->work_queue[curr];
-			if (w->is_completed == true && w->is_copied == true &&
-			    w->nsecs_target <= worker->latest_nsecs) {
-				last_entry = curr;
-				curr = w->next;
-				nr_reclaimed++;
-			} else {
-				break;
-			}
-		}
-
-		if (last_entry != -1) {
-			w = &worker->work_queue[last_entry];
-			worker->io_seq = w->next;
-			if (w->next != -1) {
-				worker->work_queue[w->next].prev = -1;
-			}
-			w->next = -1;
-
-			w = &worker->work_queue[first_entry];
-			w->prev = worker->free_seq_end;
-
-			w = &worker->work_queue[worker->free_seq_end];
-			w->next = first_entry;
-
-			worker->free_seq_end = last_entry;
-			NVMEV_DEBUG_VERBOSE("%s: %u -- %u, %d\n", __func__,
-					first_entry, last_entry, nr_reclaimed);
-		}
-	}
+	__submit_work_queue_entry(worker, sqid, entry);
 }
 
-static size_t __nvmev_proc_io(int sqid, int sq_entry, size_t *io_size)
+static size_t __nvmev_proc_io(struct nvmev_submission_queue *sq, int sqid, int sq_entry,
+			      size_t *io_size)
 {
 //	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[sqid];
 	unsigned long long nsecs_start = __get_wallclock();
 	struct nvme_command *cmd = &sq_entry(sq_entry);
 #if (BASE_SSD == KV_PROTOTYPE)
@@ -474,53 +815,46 @@ static size_t __nvmev_proc_io(int sqid, int sq_entry, size_t *io_size)
 	unsigned long long prev_clock = local_clock();
 	unsigned long long prev_clock2 = 0;
 	unsigned long long prev_clock3 = 0;
-	unsigned long long prev_clock4 = 0;
 	static unsigned long long clock1 = 0;
 	static unsigned long long clock2 = 0;
-	static unsigned long long clock3 = 0;
 	static unsigned long long counter = 0;
 #endif
 
 	if (!ns->proc_io_cmd(ns, &req, &ret))
 		return false;
+	trace_nvmev_cmd_submit(sqid, sq_entry, cmd, nsecs_start, ret.nsecs_target);
 	*io_size = __cmd_io_size(&sq_entry(sq_entry).rw);
 
 #ifdef PERF_DEBUG
 	prev_clock2 = local_clock();
 #endif
 
-	__enqueue_io_req(sqid, sq->cqid, sq_entry, nsecs_start, &ret);
+	__enqueue_io_req(sq, sqid, sq->cqid, sq_entry, nsecs_start, &ret);
 
 #ifdef PERF_DEBUG
 	prev_clock3 = local_clock();
-#endif
-
-	__reclaim_completed_reqs();
-
-#ifdef PERF_DEBUG
-	prev_clock4 = local_clock();
 
 	clock1 += (prev_clock2 - prev_clock);
 	clock2 += (prev_clock3 - prev_clock2);
-	clock3 += (prev_clock4 - prev_clock3);
 	counter++;
 
 	if (counter > 1000) {
-		NVMEV_DEBUG("LAT: %llu, ENQ: %llu, CLN: %llu\n", clock1 / counter, clock2 / counter,
-			    clock3 / counter);
+		NVMEV_DEBUG("LAT: %llu, ENQ: %llu\n", clock1 / counter, clock2 / counter);
 		clock1 = 0;
 		clock2 = 0;
-		clock3 = 0;
 		counter = 0;
 	}
 #endif
 	return true;
 }
 
-int nvmev_proc_io_sq(int sqid, int new_db, int old_db)
+/*
+ * @sq is the queue the caller looked up for @sqid; the admin queue may clear
+ * nvmev_vdev->sqes[@sqid] meanwhile, but frees @sq only after this round.
+ */
+int nvmev_proc_io_sq(struct nvmev_submission_queue *sq, int sqid, int new_db, int old_db)
 {
 //	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[sqid];
 	int num_proc = new_db - old_db;
 	int seq;
 	int sq_entry = old_db;
@@ -533,7 +867,7 @@ int nvmev_proc_io_sq(int sqid, int new_db, int old_db)
 
 	for (seq = 0; seq < num_proc; seq++) {
 		size_t io_size;
-		if (!__nvmev_proc_io(sqid, sq_entry, &io_size))
+		if (!__nvmev_proc_io(sq, sqid, sq_entry, &io_size))
 			break;
 
 		if (++sq_entry == sq->queue_size) {
@@ -550,12 +884,12 @@ int nvmev_proc_io_sq(int sqid, int new_db, int old_db)
 	return latest_db;
 }
 
-void nvmev_proc_io_cq(int cqid, int new_db, int old_db)
+void nvmev_proc_io_cq(struct nvmev_completion_queue *cq, int cqid, int new_db, int old_db)
 {
 //	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct nvmev_completion_queue *cq = nvmev_vdev->cqes[cqid];
 	int i;
 	for (i = old_db; i != new_db; i++) {
+		struct nvmev_submission_queue *sq;
 		int sqid = cq_entry(i).sq_id;
 		if (i >= cq->queue_size) {
 			i = -1;
@@ -564,9 +898,10 @@ void nvmev_proc_io_cq(int cqid, int new_db, int old_db)
 
 		/* Should check the validity here since SPDK deletes SQ immediately
 		 * before processing associated CQes */
-		if (!nvmev_vdev->sqes[sqid]) continue;
+		sq = READ_ONCE(nvmev_vdev->sqes[sqid]);
+		if (!sq) continue;
 
-		nvmev_vdev->sqes[sqid]->stat.nr_in_flight--;
+		sq->stat.nr_in_flight--;
 	}
 
 	cq->cq_tail = new_db - 1;
@@ -574,49 +909,66 @@ void nvmev_proc_io_cq(int cqid, int new_db, int old_db)
 		cq->cq_tail = cq->queue_size - 1;
 }
 
-static void __fill_cq_result(struct nvmev_io_work *w)
+/*
+ * Post the completions gathered for @cqid in one go: a single entry_lock
+ * acquisition and a single cq_head update for the whole batch.
+ */
+static void __fill_cq_results(struct nvmev_io_worker *worker, int cqid)
 {
 //	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	int sqid = w->sqid;
-	int cqid = w->cqid;
-	int sq_entry = w->sq_entry;
-	unsigned int command_id = w->command_id;
-	unsigned int status = w->status;
-	unsigned int result0 = w->result0;
-	unsigned int result1 = w->result1;
-
 	struct nvmev_completion_queue *cq = nvmev_vdev->cqes[cqid];
-	struct nvme_completion *cqe;
+	unsigned int curr;
 	int cq_head;
 
 	spin_lock(&cq->entry_lock);
 	cq_head = cq->cq_head;
-	cqe = &cq_entry(cq_head);
 
-	cqe->command_id = command_id;
-	cqe->sq_id = sqid;
-	cqe->sq_head = sq_entry;
-	cqe->status = cq->phase | (status << 1);
-	cqe->result0 = result0;
-	cqe->result1 = result1;
+	for (curr = worker->batch_head[cqid]; curr != -1; curr = worker->work_queue[curr].next) {
+		struct nvmev_io_work *w = &worker->work_queue[curr];
+		struct nvme_completion *cqe = &cq_entry(cq_head);
+
+		cqe->command_id = w->command_id;
+		cqe->sq_id = w->sqid;
+		cqe->sq_head = w->sq_entry;
+		cqe->status = cq->phase | (w->status << 1);
+		cqe->result0 = w->result0;
+		cqe->result1 = w->result1;
+
+		if (++cq_head == cq->queue_size) {
+			cq_head = 0;
+			cq->phase = !cq->phase;
+		}
 
-	if (++cq_head == cq->queue_size) {
-		cq_head = 0;
-		cq->phase = !cq->phase;
+		if (!cq->interrupt_ready)
+			cq->nsecs_first_pending = w->nsecs_target;
+		cq->interrupt_ready = true;
+		cq->nr_pending_irq++;
+		cq->stat.nr_cqes++;
 	}
 
 	cq->cq_head = cq_head;
-	cq->interrupt_ready = true;
 	spin_unlock(&cq->entry_lock);
 }
 
-static int nvmev_io_worker(void *data)
+/*
+ * Hold the interrupt back until Aggregation Threshold CQEs are posted or
+ * Aggregation Time has passed since the oldest of them, unless coalescing is
+ * disabled for the vector. Both default to 0, which means no coalescing.
+ */
+static bool __irq_coalesce_expired(struct nvmev_completion_queue *cq, unsigned long long nsecs)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	struct nvmev_io_worker *worker = (struct nvmev_io_worker *)data;
-	struct nvmev_ns *ns;
-	static unsigned long last_io_time = 0;
+	if (cq->irq_vector <= NR_MAX_IO_QUEUE &&
+	    test_bit(cq->irq_vector, nvmev_vdev->irq_coalesce_disabled))
+		return true;
+
+	if (cq->nr_pending_irq > nvmev_vdev->irq_aggr_thr)
+		return true;
 
+	return nsecs >= cq->nsecs_first_pending + nvmev_vdev->irq_aggr_time * 100000ULL;
+}
+
+static void __signal_cq_irq(struct nvmev_completion_queue *cq, unsigned long long nsecs)
+{
 #ifdef PERF_DEBUG
 	static unsigned long long intr_clock[NR_MAX_IO_QUEUE + 1];
 	static unsigned long long intr_counter[NR_MAX_IO_QUEUE + 1];
@@ -624,6 +976,97 @@ static int nvmev_io_worker(void *data)
 	unsigned long long prev_clock;
 #endif
 
+	if (!cq->irq_enabled || !READ_ONCE(cq->interrupt_ready))
+		return;
+
+	if (!mutex_trylock(&cq->irq_lock))
+		return;
+
+	if (cq->interrupt_ready == true && __irq_coalesce_expired(cq, nsecs)) {
+#ifdef PERF_DEBUG
+		prev_clock = local_clock();
+#endif
+		spin_lock(&cq->entry_lock);
+		cq->interrupt_ready = false;
+		cq->nr_pending_irq = 0;
+		spin_unlock(&cq->entry_lock);
+
+		cq->stat.nr_irqs++;
+		//SSD发中断通知主机：命令完成
+		nvmev_signal_irq(cq->irq_vector);
+
+#ifdef PERF_DEBUG
+		intr_clock[cq->qid] += (local_clock() - prev_clock);
+		intr_counter[cq->qid]++;
+
+		if (intr_counter[cq->qid] > 1000) {
+			NVMEV_DEBUG("Intr %d: %llu\n", cq->qid,
+				    intr_clock[cq->qid] / intr_counter[cq->qid]);
+			intr_clock[cq->qid] = 0;
+			intr_counter[cq->qid] = 0;
+		}
+#endif
+	}
+	mutex_unlock(&cq->irq_lock);
+}
+
+static inline void __account_lateness(struct nvmev_io_worker *worker, unsigned long long nsecs)
+{
+	unsigned int bucket = 0;
+
+	if (nsecs >= 1000)
+		bucket = min_t(unsigned int, ilog2(nsecs / 1000) + 1, NR_LATENESS_BUCKETS - 1);
+
+	worker->lateness[bucket]++;
+}
+
+/*
+ * Sleep until a spin window ahead of @nsecs_deadline, or until a dispatcher
+ * submits something new. Deadlines within the window are left to busy-wait
+ * since the hrtimer wakeup latency is in the same order.
+ *
+ * Returns false if it did not sleep.
+ */
+static bool __io_worker_sleep(struct nvmev_io_worker *worker, unsigned long long nsecs_now,
+			      unsigned long long nsecs_deadline)
+{
+	unsigned int spin_ns = nvmev_vdev->config.worker_spin_ns;
+	ktime_t expires;
+	unsigned int d;
+
+	if (nsecs_deadline <= nsecs_now + spin_ns)
+		return false;
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	smp_store_mb(worker->sleeping, true);
+
+	for (d = 0; d < nvmev_vdev->config.nr_dispatchers; d++) {
+		if (!__ring_empty(&worker->submit_rings[d]))
+			goto out;
+	}
+	if (kthread_should_stop())
+		goto out;
+
+	if (nsecs_deadline == ULLONG_MAX) {
+		schedule();
+	} else {
+		expires = ns_to_ktime(nsecs_deadline - nsecs_now - spin_ns);
+		schedule_hrtimeout(&expires, HRTIMER_MODE_REL);
+	}
+
+out:
+	__set_current_state(TASK_RUNNING);
+	WRITE_ONCE(worker->sleeping, false);
+	return true;
+}
+
+static int nvmev_io_worker(void *data)
+{
+	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
+	struct nvmev_io_worker *worker = (struct nvmev_io_worker *)data;
+	struct nvmev_ns *ns;
+	static unsigned long last_io_time = 0;
+
 	NVMEV_INFO("%s started on cpu %d (node %d)\n", worker->thread_name, smp_processor_id(),
 		   cpu_to_node(smp_processor_id()));
 
@@ -632,66 +1075,111 @@ static int nvmev_io_worker(void *data)
 		unsigned long long curr_nsecs_local = local_clock();
 		long long delta = curr_nsecs_wall - curr_nsecs_local;
 
-		volatile unsigned int curr = worker->io_seq;
+		unsigned long long nsecs_deadline;
+		unsigned int curr, d, i;
 		int qidx;
 
-		while (curr != -1) {
-			struct nvmev_io_work *w = &worker->work_queue[curr];
-			unsigned long long curr_nsecs = local_clock() + delta;
-			worker->latest_nsecs = curr_nsecs;
-
-			if (w->is_completed == true) {
-				curr = w->next;
-				continue;
-			}
+		/*
+		 * Take the new requests from every dispatcher. Data are copied right
+		 * away; the completion waits in the heap until the target time.
+		 */
+		for (d = 0; d < nvmev_vdev->config.nr_dispatchers; d++) {
+			while (__ring_pop(&worker->submit_rings[d], &curr)) {
+				struct nvmev_io_work *w = &worker->work_queue[curr];
 
-			if (w->is_copied == false) {
+				if (!w->is_copied) {
 #ifdef PERF_DEBUG
-				w->nsecs_copy_start = local_clock() + delta;
+					w->nsecs_copy_start = local_clock() + delta;
 #endif
-				if (w->is_internal) {
-					;
-				} else if (io_using_dma) {
-					__do_perform_io_using_dma(w->sqid, w->sq_entry);
-				} else {
-#if (BASE_SSD == KV_PROTOTYPE)
-					struct nvmev_submission_queue *sq =
-						nvmev_vdev->sqes[w->sqid];
-					ns = &nvmev_vdev->ns[0];
-					if (ns->identify_io_cmd(ns, sq_entry(w->sq_entry))) {
-						w->result0 = ns->perform_io_cmd(
-							ns, &sq_entry(w->sq_entry), &(w->status));
+					u16 status = NVME_SC_SUCCESS;
+
+					if (io_using_dma) {
+						/* Marked copied from the DMA completion */
+						status = __do_perform_io_using_dma(w);
 					} else {
-						__do_perform_io(w->sqid, w->sq_entry);
-					}
-#else 
-					__do_perform_io(w->sqid, w->sq_entry);
+#if (BASE_SSD == KV_PROTOTYPE)
+						struct nvmev_submission_queue *sq =
+							nvmev_vdev->sqes[w->sqid];
+						ns = &nvmev_vdev->ns[0];
+						if (ns->identify_io_cmd(ns, sq_entry(w->sq_entry))) {
+							w->result0 = ns->perform_io_cmd(
+								ns, &sq_entry(w->sq_entry), &(w->status));
+						} else {
+							status = __do_perform_io(w->sqid, w->sq_entry);
+						}
+#else
+						status = __do_perform_io(w->sqid, w->sq_entry);
 #endif
-				}
+					}
+					if (status != NVME_SC_SUCCESS)
+						w->status = status;
 
 #ifdef PERF_DEBUG
-				w->nsecs_copy_done = local_clock() + delta;
+					w->nsecs_copy_done = local_clock() + delta;
 #endif
-				w->is_copied = true;
-				last_io_time = jiffies;
+					if (!io_using_dma)
+						w->is_copied = true;
+					last_io_time = jiffies;
+
+					NVMEV_DEBUG_VERBOSE("%s: copied %u, %d %d %d\n", worker->thread_name,
+							    curr, w->sqid, w->cqid, w->sq_entry);
+				}
 
-				NVMEV_DEBUG_VERBOSE("%s: copied %u, %d %d %d\n", worker->thread_name, curr,
-					    w->sqid, w->cqid, w->sq_entry);
+				__heap_push(worker, curr);
 			}
+		}
+
+		/* Gather the requests whose target time has passed, chained per CQ */
+		while (worker->nr_heap) {
+			struct nvmev_io_work *w = &worker->work_queue[worker->heap[0]];
+			unsigned long long curr_nsecs = local_clock() + delta;
 
-			if (w->nsecs_target <= curr_nsecs) {
-				if (w->is_internal) {
+			if (w->nsecs_target > curr_nsecs)
+				break;
+
+			/* Its DMA copies are still in flight */
+			if (!smp_load_acquire(&w->is_copied))
+				break;
+
+			curr = __heap_pop(worker);
+
+			if (!w->is_internal)
+				__account_lateness(worker, curr_nsecs - w->nsecs_target);
+
+			if (w->is_internal) {
 #if (SUPPORTED_SSD_TYPE(CONV) || SUPPORTED_SSD_TYPE(ZNS))
-					buffer_release((struct buffer *)w->write_buffer,
-						       w->buffs_to_release);
+				buffer_release((struct buffer *)w->write_buffer, w->buffs_to_release);
 #endif
-				} else {
-					// SSD 写 CQ
-					__fill_cq_result(w);
-				}
+				__ring_stage(&worker->free_rings[__get_entry_owner(worker, curr)], curr);
+				continue;
+			}
 
-				NVMEV_DEBUG_VERBOSE("%s: completed %u, %d %d %d\n", worker->thread_name, curr,
-					    w->sqid, w->cqid, w->sq_entry);
+			w->next = -1;
+			if (worker->batch_head[w->cqid] == -1) {
+				worker->batch_head[w->cqid] = curr;
+				worker->batch_cqids[worker->nr_batch_cqs++] = w->cqid;
+			} else {
+				worker->work_queue[worker->batch_tail[w->cqid]].next = curr;
+			}
+			worker->batch_tail[w->cqid] = curr;
+		}
+
+		/* Post them per CQ and raise at most one interrupt per batch */
+		for (i = 0; i < worker->nr_batch_cqs; i++) {
+			int cqid = worker->batch_cqids[i];
+
+			// SSD 写 CQ
+			__fill_cq_results(worker, cqid);
+
+			curr = worker->batch_head[cqid];
+			while (curr != -1) {
+				struct nvmev_io_work *w = &worker->work_queue[curr];
+				unsigned int next = w->next;
+
+				trace_nvmev_cmd_complete(w->sqid, cqid, w->command_id, w->status,
+							 w->nsecs_start, w->nsecs_target);
+				NVMEV_DEBUG_VERBOSE("%s: completed %u, %d %d %d\n", worker->thread_name,
+						    curr, w->sqid, w->cqid, w->sq_entry);
 
 #ifdef PERF_DEBUG
 				w->nsecs_cq_filled = local_clock() + delta;
@@ -702,13 +1190,22 @@ static int nvmev_io_worker(void *data)
 					     w->nsecs_cq_filled - w->nsecs_start,
 					     w->nsecs_target - w->nsecs_start);
 #endif
-				mb(); /* Reclaimer shall see after here */
-				w->is_completed = true;
+				/* Give the entry back to the dispatcher owning it, in a batch below */
+				__ring_stage(&worker->free_rings[__get_entry_owner(worker, curr)], curr);
+				curr = next;
 			}
+			worker->batch_head[cqid] = -1;
 
-			curr = w->next;
+			__signal_cq_irq(nvmev_vdev->cqes[cqid], local_clock() + delta);
 		}
+		worker->nr_batch_cqs = 0;
+
+		for (d = 0; d < nvmev_vdev->config.nr_dispatchers; d++)
+			__ring_publish(&worker->free_rings[d]);
 
+		/* Interrupts held back by coalescing */
+		nsecs_deadline = worker->nr_heap ? worker->work_queue[worker->heap[0]].nsecs_target :
+						   ULLONG_MAX;
 		for (qidx = 1; qidx <= nvmev_vdev->nr_cq; qidx++) {
 			struct nvmev_completion_queue *cq = nvmev_vdev->cqes[qidx];
 
@@ -716,51 +1213,230 @@ static int nvmev_io_worker(void *data)
 			if ((worker->id) != __get_io_worker(qidx))
 				continue;
 #endif
-			if (cq == NULL || !cq->irq_enabled)
+			if (cq == NULL)
 				continue;
 
-			if (mutex_trylock(&cq->irq_lock)) {
-				if (cq->interrupt_ready == true) {
-#ifdef PERF_DEBUG
-					prev_clock = local_clock();
-#endif
-					cq->interrupt_ready = false;
-					//SSD发中断通知主机：命令完成
-					nvmev_signal_irq(cq->irq_vector);
+			__signal_cq_irq(cq, local_clock() + delta);
 
-#ifdef PERF_DEBUG
-					intr_clock[qidx] += (local_clock() - prev_clock);
-					intr_counter[qidx]++;
-
-					if (intr_counter[qidx] > 1000) {
-						NVMEV_DEBUG("Intr %d: %llu\n", qidx,
-							    intr_clock[qidx] / intr_counter[qidx]);
-						intr_clock[qidx] = 0;
-						intr_counter[qidx] = 0;
-					}
-#endif
-				}
-				mutex_unlock(&cq->irq_lock);
-			}
+			if (cq->irq_enabled && READ_ONCE(cq->interrupt_ready))
+				nsecs_deadline = min(nsecs_deadline,
+						     cq->nsecs_first_pending +
+							     nvmev_vdev->irq_aggr_time * 100000ULL);
 		}
-		if (CONFIG_NVMEVIRT_IDLE_TIMEOUT != 0 &&
-		    time_after(jiffies, last_io_time + (CONFIG_NVMEVIRT_IDLE_TIMEOUT * HZ)))
+
+		if (nvmev_vdev->config.worker_sleep) {
+			if (!__io_worker_sleep(worker, local_clock() + delta, nsecs_deadline))
+				cond_resched();
+		} else if (CONFIG_NVMEVIRT_IDLE_TIMEOUT != 0 &&
+			   time_after(jiffies, last_io_time + (CONFIG_NVMEVIRT_IDLE_TIMEOUT * HZ))) {
 			schedule_timeout_interruptible(1);
-		else
+		} else {
 			cond_resched();
+		}
 	}
 
 	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	return 0;
 }
 
-void NVMEV_IO_WORKER_INIT(struct nvmev_dev *nvmev_vdev)
+/*
+ * Microbenchmark of the completion scheduler: push @nr_reqs requests with
+ * random target times within a millisecond into a scratch worker, pop them
+ * all, and report the cycles spent per operation.
+ */
+void nvmev_sched_bench(unsigned int nr_reqs)
+{
+	struct nvmev_io_worker *worker;
+	unsigned long long seed = local_clock();
+	unsigned long long prev_target = 0;
+	cycles_t push_cycles, pop_cycles;
+	bool ordered = true;
+	unsigned int i;
+
+	nr_reqs = clamp_t(unsigned int, nr_reqs, 1, NR_MAX_PARALLEL_IO);
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return;
+
+	worker->work_queue = kcalloc(nr_reqs, sizeof(struct nvmev_io_work), GFP_KERNEL);
+	worker->heap = kcalloc(nr_reqs, sizeof(*worker->heap), GFP_KERNEL);
+	if (!worker->work_queue || !worker->heap)
+		goto out;
+
+	for (i = 0; i < nr_reqs; i++) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		worker->work_queue[i].nsecs_target = seed >> 44;
+	}
+
+	push_cycles = get_cycles();
+	for (i = 0; i < nr_reqs; i++)
+		__heap_push(worker, i);
+	push_cycles = get_cycles() - push_cycles;
+
+	pop_cycles = get_cycles();
+	for (i = 0; i < nr_reqs; i++) {
+		unsigned long long nsecs_target = worker->work_queue[__heap_pop(worker)].nsecs_target;
+
+		ordered &= (nsecs_target >= prev_target);
+		prev_target = nsecs_target;
+	}
+	pop_cycles = get_cycles() - pop_cycles;
+
+	NVMEV_INFO("sched_bench: %u reqs, %llu cycles/push, %llu cycles/pop%s\n", nr_reqs,
+		   (unsigned long long)push_cycles / nr_reqs, (unsigned long long)pop_cycles / nr_reqs,
+		   ordered ? "" : ", OUT OF ORDER");
+out:
+	kfree(worker->heap);
+	kfree(worker->work_queue);
+	kfree(worker);
+}
+
+/*
+ * Microbenchmark of the PRP copy path: read 4 KiB, 128 KiB and 1 MiB out of
+ * namespace 0 into a physically contiguous buffer, page by page as before
+ * and as a single run, and report the throughput of each.
+ */
+void nvmev_copy_bench(void)
+{
+	static const size_t sizes[] = { SZ_4K, SZ_128K, SZ_1M };
+	void *dev = nvmev_vdev->ns[0].mapped;
+	unsigned int order = get_order(SZ_1M);
+	unsigned long long nsecs_page, nsecs_run;
+	struct page *page;
+	phys_addr_t paddr;
+	unsigned int i, iter, nr_iters;
+	size_t offs;
+
+	if (!dev || nvmev_vdev->ns[0].size < SZ_1M)
+		return;
+
+	page = alloc_pages(GFP_KERNEL, order);
+	if (!page)
+		return;
+	paddr = page_to_phys(page);
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		nr_iters = SZ_64M / sizes[i];
+
+		nsecs_page = local_clock();
+		for (iter = 0; iter < nr_iters; iter++) {
+			for (offs = 0; offs < sizes[i]; offs += PAGE_SIZE) {
+				void *vaddr = kmap_atomic_pfn(PRP_PFN(paddr + offs));
+
+				memcpy(vaddr, dev + offs, PAGE_SIZE);
+				kunmap_atomic(vaddr);
+			}
+		}
+		nsecs_page = local_clock() - nsecs_page;
+
+		nsecs_run = local_clock();
+		for (iter = 0; iter < nr_iters; iter++)
+			__copy_prp_run(dev, paddr, sizes[i], false, NVMEV_COPY_MEMCPY);
+		nsecs_run = local_clock() - nsecs_run;
+
+		NVMEV_INFO("copy_bench: %4zu KiB, %llu MB/s per page, %llu MB/s per run\n",
+			   sizes[i] >> 10, (unsigned long long)SZ_64M * 1000 / (nsecs_page ?: 1),
+			   (unsigned long long)SZ_64M * 1000 / (nsecs_run ?: 1));
+		cond_resched();
+	}
+
+	__free_pages(page, order);
+}
+
+/*
+ * Microbenchmark of the copy kernels: stream 32 MiB through each of them
+ * while a 4 MiB working set sits in the cache, then touch the working set
+ * again. Whatever the copy evicted shows up as LLC misses.
+ */
+#define NT_BENCH_WS_SIZE SZ_4M
+
+static u64 __read_llc_misses(struct perf_event *event)
+{
+	u64 enabled, running;
+
+	return event ? perf_event_read_value(event, &enabled, &running) : 0;
+}
+
+void nvmev_nt_bench(void)
+{
+	static const struct {
+		const char *name;
+		bool to_dev;
+		unsigned int copy_mode;
+	} cases[] = {
+		{ "write memcpy", true, NVMEV_COPY_MEMCPY },
+		{ "write nocache", true, NVMEV_COPY_NOCACHE },
+		{ "read memcpy", false, NVMEV_COPY_MEMCPY },
+		{ "read prefetch", false, NVMEV_COPY_PREFETCH },
+	};
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_HARDWARE,
+		.size = sizeof(attr),
+		.config = PERF_COUNT_HW_CACHE_MISSES,
+	};
+	struct perf_event *event;
+	void *storage, *host, *ws;
+	unsigned long long nsecs, misses;
+	unsigned int i, sum = 0;
+	size_t offs;
+
+	storage = vmalloc(SZ_32M);
+	host = vmalloc(SZ_1M);
+	ws = vmalloc(NT_BENCH_WS_SIZE);
+	if (!storage || !host || !ws)
+		goto out;
+
+	event = perf_event_create_kernel_counter(&attr, -1, current, NULL, NULL);
+	if (IS_ERR(event)) {
+		NVMEV_INFO("nt_bench: LLC miss counter unavailable (%ld)\n", PTR_ERR(event));
+		event = NULL;
+	}
+
+	memset(storage, 0, SZ_32M);
+	memset(host, 0, SZ_1M);
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		memset(ws, i, NT_BENCH_WS_SIZE);
+		misses = __read_llc_misses(event);
+
+		nsecs = local_clock();
+		for (offs = 0; offs < SZ_32M; offs += SZ_1M)
+			__copy_data(storage + offs, host, SZ_1M, cases[i].to_dev, cases[i].copy_mode);
+		if (cases[i].copy_mode & NVMEV_COPY_NOCACHE)
+			wmb();
+		nsecs = local_clock() - nsecs;
+
+		for (offs = 0; offs < NT_BENCH_WS_SIZE; offs += L1_CACHE_BYTES)
+			sum += READ_ONCE(*(u8 *)(ws + offs));
+		misses = __read_llc_misses(event) - misses;
+
+		NVMEV_INFO("nt_bench: %-13s %llu MB/s, %llu LLC misses\n", cases[i].name,
+			   (unsigned long long)SZ_32M * 1000 / (nsecs ?: 1), misses);
+		cond_resched();
+	}
+
+	if (event)
+		perf_event_release_kernel(event);
+	NVMEV_DEBUG("nt_bench: checksum %u\n", sum);
+out:
+	vfree(ws);
+	vfree(host);
+	vfree(storage);
+}
+
+bool NVMEV_IO_WORKER_INIT(struct nvmev_dev *nvmev_vdev)
 {
 	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	unsigned int i, worker_id;
+	unsigned int nr_dispatchers = nvmev_vdev->config.nr_dispatchers;
+	unsigned int i, d, worker_id;
 
-	nvmev_vdev->io_workers =
-		kcalloc(sizeof(struct nvmev_io_worker), nvmev_vdev->config.nr_io_workers, GFP_KERNEL);
+	nvmev_vdev->io_workers = kcalloc(nvmev_vdev->config.nr_io_workers,
+					 sizeof(*nvmev_vdev->io_workers), GFP_KERNEL);
+	if (!nvmev_vdev->io_workers) {
+		NVMEV_ERROR("Failed to allocate io workers\n");
+		return false;
+	}
 	nvmev_vdev->io_worker_turn = 0;
 
 	//创建nvmev_vdev->config.nr_io_workers个数量的io worker
@@ -769,31 +1445,55 @@ void NVMEV_IO_WORKER_INIT(struct nvmev_dev *nvmev_vdev)
 
 		worker->work_queue =
 			kzalloc(sizeof(struct nvmev_io_work) * NR_MAX_PARALLEL_IO, GFP_KERNEL);
-		for (i = 0; i < NR_MAX_PARALLEL_IO; i++) {
-			worker->work_queue[i].next = i + 1;
-			worker->work_queue[i].prev = i - 1;
-		}
-		worker->work_queue[NR_MAX_PARALLEL_IO - 1].next = -1;
 		worker->id = worker_id;
-		worker->free_seq = 0;
-		worker->free_seq_end = NR_MAX_PARALLEL_IO - 1;
-		worker->io_seq = -1;
-		worker->io_seq_end = -1;
+		worker->heap = kcalloc(NR_MAX_PARALLEL_IO, sizeof(*worker->heap), GFP_KERNEL);
+		worker->nr_heap = 0;
+		memset(worker->batch_head, 0xFF, sizeof(worker->batch_head));
+		worker->nr_batch_cqs = 0;
+
+		/* Split @work_queue evenly; each dispatcher starts with all of its entries free */
+		worker->nr_entries_per_dispatcher = NR_MAX_PARALLEL_IO / nr_dispatchers;
+		worker->submit_rings = kcalloc(nr_dispatchers, sizeof(struct nvmev_io_ring), GFP_KERNEL);
+		worker->free_rings = kcalloc(nr_dispatchers, sizeof(struct nvmev_io_ring), GFP_KERNEL);
+		if (!worker->work_queue || !worker->heap || !worker->submit_rings ||
+		    !worker->free_rings)
+			goto out_err;
+
+		for (d = 0; d < nr_dispatchers; d++) {
+			if (!__ring_init(&worker->submit_rings[d], worker->nr_entries_per_dispatcher) ||
+			    !__ring_init(&worker->free_rings[d], worker->nr_entries_per_dispatcher))
+				goto out_err;
+
+			for (i = 0; i < worker->nr_entries_per_dispatcher; i++)
+				__ring_push(&worker->free_rings[d],
+					    d * worker->nr_entries_per_dispatcher + i);
+		}
 
 		snprintf(worker->thread_name, sizeof(worker->thread_name), "nvmev_io_worker_%d", worker_id);
 
 		worker->task_struct = kthread_create(nvmev_io_worker, worker, "%s", worker->thread_name);
+		if (IS_ERR(worker->task_struct))
+			goto out_err;
 
 		kthread_bind(worker->task_struct, nvmev_vdev->config.cpu_nr_io_workers[worker_id]);
 		wake_up_process(worker->task_struct);
 	}
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
+	return true;
+
+out_err:
+	NVMEV_ERROR("Failed to set up nvmev_io_worker_%d\n", worker_id);
+	NVMEV_IO_WORKER_FINAL(nvmev_vdev);
+	return false;
 }
 
 void NVMEV_IO_WORKER_FINAL(struct nvmev_dev *nvmev_vdev)
 {
 	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	unsigned int i;
+	unsigned int i, d;
+
+	if (!nvmev_vdev->io_workers)
+		return;
 
 	for (i = 0; i < nvmev_vdev->config.nr_io_workers; i++) {
 		struct nvmev_io_worker *worker = &nvmev_vdev->io_workers[i];
@@ -801,10 +1501,28 @@ void NVMEV_IO_WORKER_FINAL(struct nvmev_dev *nvmev_vdev)
 		if (!IS_ERR_OR_NULL(worker->task_struct)) {
 			kthread_stop(worker->task_struct);
 		}
+	}
+
+	/* DMA completions still point into the work queues */
+	if (io_using_dma)
+		ioat_dma_flush();
+
+	for (i = 0; i < nvmev_vdev->config.nr_io_workers; i++) {
+		struct nvmev_io_worker *worker = &nvmev_vdev->io_workers[i];
 
+		for (d = 0; d < nvmev_vdev->config.nr_dispatchers; d++) {
+			if (worker->submit_rings)
+				kfree(worker->submit_rings[d].entries);
+			if (worker->free_rings)
+				kfree(worker->free_rings[d].entries);
+		}
+		kfree(worker->submit_rings);
+		kfree(worker->free_rings);
+		kfree(worker->heap);
 		kfree(worker->work_queue);
 	}
 
 	kfree(nvmev_vdev->io_workers);
+	nvmev_vdev->io_workers = NULL;
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
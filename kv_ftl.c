@@ -506,15 +506,11 @@ static unsigned int __do_perform_kv_io(struct kv_ftl *kv_ftl, struct nvme_kv_com
 				       unsigned int *status)
 {
 	size_t offset;
-	size_t length, remaining;
-	int prp_offs = 0;
-	int prp2_offs = 0;
-	u64 paddr;
-	u64 *paddr_list = NULL;
-	size_t mem_offs = 0;
+	size_t length;
 	size_t new_offset = 0;
 	struct mapping_entry entry;
 	int is_insert = 0;
+	u16 dptr_status;
 
 	entry = get_mapping_entry(kv_ftl, cmd);
 	offset = entry.mem_offset;
@@ -580,53 +576,17 @@ static unsigned int __do_perform_kv_io(struct kv_ftl *kv_ftl, struct nvme_kv_com
 
 		return 0;
 	}
-	remaining = length;
-
-	while (remaining) {
-		size_t io_size;
-		void *vaddr;
-
-		mem_offs = 0;
-		prp_offs++;
-		if (prp_offs == 1) {
-			paddr = kv_io_cmd_value_prp(cmd, 1);
-		} else if (prp_offs == 2) {
-			paddr = kv_io_cmd_value_prp(cmd, 2);
-			if (remaining > PAGE_SIZE) {
-				paddr_list = kmap_atomic_pfn(PRP_PFN(paddr)) +
-					     (paddr & PAGE_OFFSET_MASK);
-				paddr = paddr_list[prp2_offs++];
-			}
-		} else {
-			paddr = paddr_list[prp2_offs++];
-		}
-
-		vaddr = kmap_atomic_pfn(PRP_PFN(paddr));
-
-		io_size = min_t(size_t, remaining, PAGE_SIZE);
-
-		if (paddr & PAGE_OFFSET_MASK) { // 일반 block io면 언제 여기에 해당?
-			mem_offs = paddr & PAGE_OFFSET_MASK;
-			if (io_size + mem_offs > PAGE_SIZE)
-				io_size = PAGE_SIZE - mem_offs;
-		}
-		if (cmd.common.opcode == nvme_cmd_kv_store) {
-			memcpy(nvmev_vdev->storage_mapped + offset, vaddr + mem_offs, io_size);
-		} else if (cmd.common.opcode == nvme_cmd_kv_retrieve) {
-			memcpy(vaddr + mem_offs, nvmev_vdev->storage_mapped + offset, io_size);
-		} else {
-			NVMEV_ERROR("Wrong KV Command passed to NVMeVirt!!\n");
-		}
-
-		kunmap_atomic(vaddr);
-
-		remaining -= io_size;
-		offset += io_size;
+	dptr_status = nvmev_dptr_copy(cmd.common.flags, kv_io_cmd_value_prp(cmd, 1),
+				      kv_io_cmd_value_prp(cmd, 2), nvmev_vdev->storage_mapped + offset,
+				      length, cmd.common.opcode == nvme_cmd_kv_store,
+				      nvmev_vdev->ns[0].copy_mode);
+	if (dptr_status != NVME_SC_SUCCESS) {
+		NVMEV_ERROR("Invalid value dptr for key %s\n", cmd.kv_store.key);
+
+		*status = dptr_status;
+		return 0;
 	}
 
-	if (paddr_list != NULL)
-		kunmap_atomic(paddr_list);
-
 	if (is_insert == 1) { // need to make new mapping
 		new_mapping_entry(kv_ftl, cmd, new_offset);
 	} else if (is_insert == 2) {
@@ -967,6 +927,8 @@ bool kv_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struct
 {
 	struct nvme_command *cmd = req->cmd;
 
+	/* io_unit_stat is shared by all dispatchers */
+	spin_lock(&nvmev_vdev->io_unit_lock);
 	switch (cmd->common.opcode) {
 	case nvme_cmd_write:
 	case nvme_cmd_read:
@@ -992,6 +954,8 @@ bool kv_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struct
 		break;
 	}
 
+	spin_unlock(&nvmev_vdev->io_unit_lock);
+
 	return true;
 }
 
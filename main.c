@@ -10,6 +10,8 @@
 #include <linux/delay.h>
 #include <linux/uaccess.h>
 #include <linux/version.h>
+#include <linux/timex.h>
+#include <linux/vmalloc.h>
 
 #ifdef CONFIG_X86
 #include <asm/e820/types.h>
@@ -23,6 +25,9 @@
 #include "kv_ftl.h"
 #include "dma.h"
 
+#define CREATE_TRACE_POINTS
+#include "nvmev_trace.h"
+
 /****************************************************************
  * Memory Layout
  ****************************************************************
@@ -101,9 +106,13 @@ static unsigned int nr_io_units = 8;
 static unsigned int io_unit_shift = 12;
 
 static char *cpus;
+static unsigned int nr_dispatchers = 1;
+static unsigned int copy_mode = NVMEV_COPY_MEMCPY;
+static bool worker_sleep = false;
+static unsigned int worker_spin_ns = 10000;
 static unsigned int debug = 0;
 
-int io_using_dma = false;
+bool io_using_dma = false;
 
 static int set_parse_mem_param(const char *val, const struct kernel_param *kp)
 {
@@ -141,18 +150,40 @@ module_param(io_unit_shift, uint, 0444);
 MODULE_PARM_DESC(io_unit_shift, "Size of each I/O unit (2^)");
 module_param(cpus, charp, 0444);
 MODULE_PARM_DESC(cpus, "CPU list for process, completion(int.) threads, Seperated by Comma(,)");
+module_param(nr_dispatchers, uint, 0444);
+MODULE_PARM_DESC(nr_dispatchers, "Number of dispatcher threads, taken from the head of cpus");
+module_param(worker_sleep, bool, 0444);
+MODULE_PARM_DESC(worker_sleep, "Let I/O workers sleep on an hrtimer until the next completion");
+module_param(worker_spin_ns, uint, 0444);
+MODULE_PARM_DESC(worker_spin_ns, "Busy-wait window of sleeping I/O workers in nanoseconds");
+module_param(copy_mode, uint, 0444);
+MODULE_PARM_DESC(copy_mode, "Initial copy mode of namespaces: 1 non-temporal writes, 2 prefetched reads");
+module_param(io_using_dma, bool, 0444);
+MODULE_PARM_DESC(io_using_dma, "Copy data with DMA engines, or a software stand-in if none");
 module_param(debug, uint, 0644);
 
-// Returns true if an event is processed
-static bool nvmev_proc_dbs(void)
+/*
+ * Each dispatcher owns the I/O queues whose qid satisfies
+ * (qid - 1) % nr_dispatchers == id. The admin queue and the BAR belong to
+ * dispatcher 0.
+ *
+ * Returns true if an event is processed
+ */
+static bool nvmev_proc_dbs(struct nvmev_dispatcher *dispatcher)
 {
 	// NVMEV_INFO("file: [%s]-[%s] start\n", __FILE__, __FUNCTION__);
+	const unsigned int nr_dispatchers = nvmev_vdev->config.nr_dispatchers;
+	/* Pairs with smp_store_release() in the Doorbell Buffer Config command */
+	u32 *dbs = smp_load_acquire(&nvmev_vdev->dbbuf_dbs);
 	int qid;
 	int dbs_idx;
 	int new_db;
 	int old_db;
 	bool updated = false;
 
+	if (dispatcher->id != 0)
+		goto io_queues;
+
 	// Admin queue
 	new_db = nvmev_vdev->dbs[0];
 	if (new_db != nvmev_vdev->old_dbs[0]) {
@@ -167,29 +198,47 @@ static bool nvmev_proc_dbs(void)
 		updated = true;
 	}
 
+io_queues:
+	if (!dbs)
+		dbs = (u32 *)nvmev_vdev->dbs;
+
 	// Submission queues
-	for (qid = 1; qid <= nvmev_vdev->nr_sq; qid++) {
-		if (nvmev_vdev->sqes[qid] == NULL)
+	for (qid = dispatcher->id + 1; qid <= nvmev_vdev->nr_sq; qid += nr_dispatchers) {
+		/* Dispatcher 0 may delete the queue; load it once */
+		struct nvmev_submission_queue *sq = READ_ONCE(nvmev_vdev->sqes[qid]);
+
+		if (sq == NULL)
 			continue;
 		dbs_idx = qid * 2;
-		new_db = nvmev_vdev->dbs[dbs_idx];
+		new_db = READ_ONCE(dbs[dbs_idx]);
 		old_db = nvmev_vdev->old_dbs[dbs_idx];
 		if (new_db != old_db) {
-			nvmev_vdev->old_dbs[dbs_idx] = nvmev_proc_io_sq(qid, new_db, old_db);
+			int queue_size = sq->queue_size;
+			cycles_t cycles = get_cycles();
+			int db = nvmev_proc_io_sq(sq, qid, new_db, old_db);
+
+			dispatcher->nr_cycles += get_cycles() - cycles;
+			dispatcher->nr_cmds += (db - old_db + queue_size) % queue_size;
+
+			nvmev_vdev->old_dbs[dbs_idx] = db;
+			nvmev_dbbuf_update_event(dbs_idx, db, queue_size);
 			updated = true;
 		}
 	}
 
 	// Completion queues
-	for (qid = 1; qid <= nvmev_vdev->nr_cq; qid++) {
-		if (nvmev_vdev->cqes[qid] == NULL)
+	for (qid = dispatcher->id + 1; qid <= nvmev_vdev->nr_cq; qid += nr_dispatchers) {
+		struct nvmev_completion_queue *cq = READ_ONCE(nvmev_vdev->cqes[qid]);
+
+		if (cq == NULL)
 			continue;
 		dbs_idx = qid * 2 + 1;
-		new_db = nvmev_vdev->dbs[dbs_idx];
+		new_db = READ_ONCE(dbs[dbs_idx]);
 		old_db = nvmev_vdev->old_dbs[dbs_idx];
 		if (new_db != old_db) {
-			nvmev_proc_io_cq(qid, new_db, old_db);
+			nvmev_proc_io_cq(cq, qid, new_db, old_db);
 			nvmev_vdev->old_dbs[dbs_idx] = new_db;
+			nvmev_dbbuf_update_event(dbs_idx, new_db, cq->queue_size);
 			updated = true;
 		}
 	}
@@ -198,20 +247,37 @@ static bool nvmev_proc_dbs(void)
 	return updated;
 }
 
+static void __proc_idle_ns(void)
+{
+	int i;
+
+	for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+		struct nvmev_ns *ns = &nvmev_vdev->ns[i];
+
+		if (ns->proc_idle)
+			ns->proc_idle(ns);
+	}
+}
+
 static int nvmev_dispatcher(void *data)
 {
 	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	static unsigned long last_dispatched_time = 0;
+	struct nvmev_dispatcher *dispatcher = (struct nvmev_dispatcher *)data;
+	unsigned long last_dispatched_time = 0;
 
-	NVMEV_INFO("nvmev_dispatcher started on cpu %d (node %d)\n",
-		   nvmev_vdev->config.cpu_nr_dispatcher,
-		   cpu_to_node(nvmev_vdev->config.cpu_nr_dispatcher));
+	NVMEV_INFO("%s started on cpu %d (node %d)\n", dispatcher->thread_name,
+		   smp_processor_id(), cpu_to_node(smp_processor_id()));
 
 	while (!kthread_should_stop()) {
-		if (nvmev_proc_bars())//处理bar
+		if (dispatcher->id == 0 && nvmev_proc_bars())//处理bar
 			last_dispatched_time = jiffies;
-		if (nvmev_proc_dbs()) //处理doorbell，即命令
+		if (nvmev_proc_dbs(dispatcher)) //处理doorbell，即命令
 			last_dispatched_time = jiffies;
+		else
+			__proc_idle_ns();
+
+		/* Pairs with the smp_mb() in nvmev_sync_dispatchers() */
+		smp_store_release(&dispatcher->nr_loops, dispatcher->nr_loops + 1);
 
 		if (CONFIG_NVMEVIRT_IDLE_TIMEOUT != 0 &&
 		    time_after(jiffies, last_dispatched_time + (CONFIG_NVMEVIRT_IDLE_TIMEOUT * HZ)))
@@ -224,23 +290,89 @@ static int nvmev_dispatcher(void *data)
 	return 0;
 }
 
-static void NVMEV_DISPATCHER_INIT(struct nvmev_dev *nvmev_vdev)
+/*
+ * Wait until every other dispatcher has finished the polling round it is in.
+ * Called after a queue is unpublished from sqes[]/cqes[] and before it is
+ * freed, so that no dispatcher can still be looking at it.
+ */
+void nvmev_sync_dispatchers(void)
+{
+	unsigned int i;
+
+	smp_mb(); /* Unpublished queue shall be seen by the next round */
+
+	for (i = 0; i < nvmev_vdev->config.nr_dispatchers; i++) {
+		struct nvmev_dispatcher *dispatcher = &nvmev_vdev->dispatchers[i];
+		unsigned long nr_loops;
+
+		if (dispatcher->task_struct == current)
+			continue;
+
+		nr_loops = smp_load_acquire(&dispatcher->nr_loops);
+		while (smp_load_acquire(&dispatcher->nr_loops) == nr_loops)
+			cpu_relax();
+	}
+}
+
+static void NVMEV_DISPATCHER_FINAL(struct nvmev_dev *nvmev_vdev);
+
+static bool NVMEV_DISPATCHER_INIT(struct nvmev_dev *nvmev_vdev)
 {
 	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	nvmev_vdev->nvmev_dispatcher = kthread_create(nvmev_dispatcher, NULL, "nvmev_dispatcher");
-	if (nvmev_vdev->config.cpu_nr_dispatcher != -1)
-		kthread_bind(nvmev_vdev->nvmev_dispatcher, nvmev_vdev->config.cpu_nr_dispatcher);
-	wake_up_process(nvmev_vdev->nvmev_dispatcher);
+	unsigned int nr_dispatchers = nvmev_vdev->config.nr_dispatchers;
+	unsigned int i;
+
+	nvmev_vdev->dispatchers =
+		kcalloc(nr_dispatchers, sizeof(*nvmev_vdev->dispatchers), GFP_KERNEL);
+	if (!nvmev_vdev->dispatchers) {
+		NVMEV_ERROR("Failed to allocate dispatchers\n");
+		return false;
+	}
+
+	for (i = 0; i < nr_dispatchers; i++) {
+		struct nvmev_dispatcher *dispatcher = &nvmev_vdev->dispatchers[i];
+		unsigned int cpu_nr = nvmev_vdev->config.cpu_nr_dispatchers[i];
+
+		dispatcher->id = i;
+		snprintf(dispatcher->thread_name, sizeof(dispatcher->thread_name),
+			 "nvmev_dispatcher_%d", i);
+
+		dispatcher->task_struct = kthread_create(nvmev_dispatcher, dispatcher, "%s",
+							 dispatcher->thread_name);
+		if (IS_ERR(dispatcher->task_struct)) {
+			NVMEV_ERROR("Failed to create %s\n", dispatcher->thread_name);
+			NVMEV_DISPATCHER_FINAL(nvmev_vdev);
+			return false;
+		}
+		if (cpu_nr != -1)
+			kthread_bind(dispatcher->task_struct, cpu_nr);
+	}
+
+	/* Start them only after all of them are set up for nvmev_sync_dispatchers() */
+	for (i = 0; i < nr_dispatchers; i++)
+		wake_up_process(nvmev_vdev->dispatchers[i].task_struct);
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
+	return true;
 }
 
 static void NVMEV_DISPATCHER_FINAL(struct nvmev_dev *nvmev_vdev)
 {
 	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	if (!IS_ERR_OR_NULL(nvmev_vdev->nvmev_dispatcher)) {
-		kthread_stop(nvmev_vdev->nvmev_dispatcher);
-		nvmev_vdev->nvmev_dispatcher = NULL;
+	unsigned int i;
+
+	if (!nvmev_vdev->dispatchers)
+		return;
+
+	for (i = 0; i < nvmev_vdev->config.nr_dispatchers; i++) {
+		struct nvmev_dispatcher *dispatcher = &nvmev_vdev->dispatchers[i];
+
+		if (!IS_ERR_OR_NULL(dispatcher->task_struct)) {
+			kthread_stop(dispatcher->task_struct);
+		}
 	}
+
+	kfree(nvmev_vdev->dispatchers);
+	nvmev_vdev->dispatchers = NULL;
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
@@ -309,6 +441,10 @@ static int __validate_configs(void)
 		NVMEV_ERROR("Need non-zero write time\n");
 		return -EINVAL;
 	}
+	if (nr_dispatchers == 0 || nr_dispatchers > 32) {
+		NVMEV_ERROR("Need 1 to 32 dispatchers\n");
+		return -EINVAL;
+	}
 
 	// NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return 0;
@@ -350,6 +486,9 @@ static int __get_nr_entries(int dbs_idx, int queue_size)
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 }
 
+/* Buckets of the erase count histogram in /proc/nvmev/wear */
+#define NR_WEAR_BUCKETS 8
+
 static int __proc_file_read(struct seq_file *m, void *data)
 {
 	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
@@ -390,8 +529,141 @@ static int __proc_file_read(struct seq_file *m, void *data)
 		}
 		seq_printf(m, "total: %u %u %u %llu\n", nr_in_flight, nr_dispatch, nr_dispatched,
 			   total_io);
+
+		for (i = 1; i <= nvmev_vdev->nr_cq; i++) {
+			struct nvmev_completion_queue *cq = nvmev_vdev->cqes[i];
+			if (!cq)
+				continue;
+
+			seq_printf(m, "cq %2d: %llu cqes %llu irqs\n", i, cq->stat.nr_cqes,
+				   cq->stat.nr_irqs);
+		}
+	} else if (strcmp(filename, "copy_mode") == 0) {
+		int i;
+
+		for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+			unsigned int mode = nvmev_vdev->ns[i].copy_mode;
+
+			seq_printf(m, "ns %d: %u (%s writes, %s reads)\n", i, mode,
+				   mode & NVMEV_COPY_NOCACHE ? "nocache" : "memcpy",
+				   mode & NVMEV_COPY_PREFETCH ? "prefetch" : "memcpy");
+		}
+	} else if (strcmp(filename, "gc") == 0) {
+		int i, j, p;
+
+		for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+			struct conv_ftl *conv_ftls = nvmev_vdev->ns[i].ftls;
+
+			if (NS_SSD_TYPE(i) != SSD_TYPE_CONV)
+				continue;
+
+			for (j = 0; j < nvmev_vdev->ns[i].nr_parts; j++) {
+				struct conv_ftl *conv_ftl = &conv_ftls[j];
+
+				seq_printf(m,
+					   "ns %d part %d: %s, hot age %u, %u free (bg watermark %u), %u victim, %u full lines, %llu fg gc, %llu bg gc\n",
+					   i, j, conv_gc_policy_name(conv_ftl->cp.gc_policy),
+					   conv_ftl->cp.hot_thres_lines,
+					   conv_ftl->lm.free_line_cnt,
+					   conv_ftl->cp.bg_gc_thres_lines, conv_ftl->lm.victim_line_cnt,
+					   conv_ftl->lm.full_line_cnt, conv_ftl->nr_fg_gc,
+					   conv_ftl->nr_bg_gc);
+				if (conv_ftl->cmt.nr_slots)
+					seq_printf(m,
+						   "ns %d part %d: cmt %u/%u tpages, %llu hits, %llu misses, %llu writebacks\n",
+						   i, j, conv_ftl->cmt.nr_used, conv_ftl->cmt.nr_tpages,
+						   conv_ftl->cmt.hits, conv_ftl->cmt.misses,
+						   conv_ftl->cmt.writebacks);
+				seq_printf(m, "ns %d part %d: write cache %u pages, %llu read hits\n", i,
+					   j, conv_ftl->wcache.nr_slots, conv_ftl->wcache.hits);
+			}
+
+			for (p = 0; p < NR_GC_POLICIES; p++) {
+				struct gc_policy_stat sum = {};
+				unsigned long long waf;
+
+				for (j = 0; j < nvmev_vdev->ns[i].nr_parts; j++) {
+					struct gc_policy_stat *stat = &conv_ftls[j].gc_stat[p];
+
+					sum.nr_gc += stat->nr_gc;
+					sum.host_pgs += stat->host_pgs;
+					sum.gc_pgs += stat->gc_pgs;
+					sum.nsecs += stat->nsecs;
+				}
+
+				waf = sum.host_pgs ? (sum.host_pgs + sum.gc_pgs) * 100 / sum.host_pgs : 0;
+				seq_printf(m,
+					   "ns %d %-12s: %llu gc, %llu host pgs, %llu gc pgs, WAF %llu.%02llu, %llu us/gc\n",
+					   i, conv_gc_policy_name(p), sum.nr_gc, sum.host_pgs, sum.gc_pgs,
+					   waf / 100, waf % 100,
+					   sum.nr_gc ? sum.nsecs / sum.nr_gc / 1000 : 0);
+			}
+		}
+	} else if (strcmp(filename, "wear") == 0) {
+		int i, j, k;
+
+		for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+			struct conv_ftl *conv_ftls = nvmev_vdev->ns[i].ftls;
+
+			if (NS_SSD_TYPE(i) != SSD_TYPE_CONV)
+				continue;
+
+			for (j = 0; j < nvmev_vdev->ns[i].nr_parts; j++) {
+				struct line_mgmt *lm = &conv_ftls[j].lm;
+				unsigned int hist[NR_WEAR_BUCKETS] = {};
+				unsigned int min = UINT_MAX, max = 0, width;
+				unsigned long long sum = 0;
+
+				for (k = 0; k < lm->tt_lines; k++) {
+					unsigned int cnt = READ_ONCE(lm->lines[k].erase_cnt);
+
+					min = min_t(unsigned int, min, cnt);
+					max = max_t(unsigned int, max, cnt);
+					sum += cnt;
+				}
+				width = (max - min) / NR_WEAR_BUCKETS + 1;
+				/* GC keeps erasing while we read; lines erased since count as max */
+				for (k = 0; k < lm->tt_lines; k++) {
+					unsigned int cnt = clamp_t(unsigned int,
+								   READ_ONCE(lm->lines[k].erase_cnt), min, max);
+
+					hist[(cnt - min) / width]++;
+				}
+
+				seq_printf(m,
+					   "ns %d part %d: erase count min %u max %u avg %llu, wl threshold %u, %llu wl, %llu wl pgs\n",
+					   i, j, min, max, lm->tt_lines ? sum / lm->tt_lines : 0,
+					   conv_ftls[j].cp.wl_thres_erases, conv_ftls[j].nr_wl,
+					   conv_ftls[j].wl_pgs);
+				for (k = 0; k < NR_WEAR_BUCKETS && min + k * width <= max; k++)
+					seq_printf(m, "  %6u - %6u: %u lines\n", min + k * width,
+						   min + (k + 1) * width - 1, hist[k]);
+			}
+		}
 	} else if (strcmp(filename, "debug") == 0) {
-		/* Left for later use */
+		int i;
+
+		for (i = 0; i < cfg->nr_dispatchers; i++) {
+			struct nvmev_dispatcher *dispatcher = &nvmev_vdev->dispatchers[i];
+			unsigned long long nr_cmds = dispatcher->nr_cmds;
+
+			seq_printf(m, "%s: %llu cmds, %llu cycles/cmd\n", dispatcher->thread_name,
+				   nr_cmds, nr_cmds ? dispatcher->nr_cycles / nr_cmds : 0);
+		}
+
+		seq_printf(m, "completion lateness, %s:\n", cfg->worker_sleep ? "sleep" : "polling");
+		for (i = 0; i < NR_LATENESS_BUCKETS; i++) {
+			unsigned long long nr = 0;
+			int w;
+
+			for (w = 0; w < cfg->nr_io_workers; w++)
+				nr += nvmev_vdev->io_workers[w].lateness[i];
+
+			if (i < NR_LATENESS_BUCKETS - 1)
+				seq_printf(m, "  < %5u us: %llu\n", 1U << i, nr);
+			else
+				seq_printf(m, "  >=%5u us: %llu\n", 1U << (i - 1), nr);
+		}
 	}
 
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
@@ -410,7 +682,8 @@ static ssize_t __proc_file_write(struct file *file, const char __user *buf, size
 	struct nvmev_config *cfg = &nvmev_vdev->config;
 	size_t nr_copied;
 
-	nr_copied = copy_from_user(input, buf, min(len, sizeof(input)));
+	nr_copied = copy_from_user(input, buf, min(len, sizeof(input) - 1));
+	input[min(len, sizeof(input) - 1)] = '\0';
 
 	if (!strcmp(filename, "read_times")) {
 		ret = sscanf(input, "%u %u %u", &cfg->read_delay, &cfg->read_time,
@@ -421,17 +694,26 @@ static ssize_t __proc_file_write(struct file *file, const char __user *buf, size
 			     &cfg->write_trailing);
 		//adjust_ftl_latency(1, cfg->write_time);
 	} else if (!strcmp(filename, "io_units")) {
-		ret = sscanf(input, "%d %d", &cfg->nr_io_units, &cfg->io_unit_shift);
-		if (ret < 1)
+		unsigned int nr_units = cfg->nr_io_units;
+		unsigned int unit_shift = cfg->io_unit_shift;
+		unsigned long long *new_stat;
+
+		ret = sscanf(input, "%u %u", &nr_units, &unit_shift);
+		if (ret < 1 || nr_units == 0)
+			goto out;
+
+		new_stat = kzalloc(sizeof(*new_stat) * nr_units, GFP_KERNEL);
+		if (!new_stat)
 			goto out;
 
+		/* Dispatchers look at the stat and the unit config under io_unit_lock */
+		spin_lock(&nvmev_vdev->io_unit_lock);
 		old_stat = nvmev_vdev->io_unit_stat;
-		nvmev_vdev->io_unit_stat =
-			kzalloc(sizeof(*nvmev_vdev->io_unit_stat) * cfg->nr_io_units, GFP_KERNEL);
+		nvmev_vdev->io_unit_stat = new_stat;
+		cfg->nr_io_units = nr_units;
+		cfg->io_unit_shift = unit_shift;
+		spin_unlock(&nvmev_vdev->io_unit_lock);
 
-		mdelay(100); /* XXX: Delay the free of old stat so that outstanding
-						 * requests accessing the unit_stat are all returned
-						 */
 		kfree(old_stat);
 	} else if (!strcmp(filename, "stat")) {
 		int i;
@@ -442,8 +724,109 @@ static ssize_t __proc_file_write(struct file *file, const char __user *buf, size
 
 			memset(&sq->stat, 0x00, sizeof(sq->stat));
 		}
+		for (i = 1; i <= nvmev_vdev->nr_cq; i++) {
+			struct nvmev_completion_queue *cq = nvmev_vdev->cqes[i];
+			if (!cq)
+				continue;
+
+			memset(&cq->stat, 0x00, sizeof(cq->stat));
+		}
+	} else if (!strcmp(filename, "copy_mode")) {
+		unsigned int nsid, mode;
+
+		if (sscanf(input, "%u %u", &nsid, &mode) != 2 || nsid >= nvmev_vdev->nr_ns ||
+		    mode & ~NVMEV_COPY_MODE_MASK) {
+			NVMEV_ERROR("Usage: echo <ns> <copy mode> > copy_mode\n");
+			return -EINVAL;
+		}
+		WRITE_ONCE(nvmev_vdev->ns[nsid].copy_mode, mode);
+	} else if (!strcmp(filename, "gc")) {
+		char name[16];
+		unsigned int nr_lines = 0, policy = NR_GC_POLICIES;
+		int i, j;
+
+		if (sscanf(input, "hot %u", &nr_lines) == 1) {
+			for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+				struct conv_ftl *conv_ftls = nvmev_vdev->ns[i].ftls;
+
+				if (NS_SSD_TYPE(i) != SSD_TYPE_CONV)
+					continue;
+
+				for (j = 0; j < nvmev_vdev->ns[i].nr_parts; j++)
+					WRITE_ONCE(conv_ftls[j].cp.hot_thres_lines, nr_lines);
+			}
+			goto out;
+		} else if (sscanf(input, "policy %15s", name) == 1) {
+			for (policy = 0; policy < NR_GC_POLICIES; policy++)
+				if (!strcmp(name, conv_gc_policy_name(policy)))
+					break;
+			if (policy == NR_GC_POLICIES) {
+				NVMEV_ERROR("Unknown GC policy %s\n", name);
+				return -EINVAL;
+			}
+		} else if (sscanf(input, "%u", &nr_lines) != 1) {
+			NVMEV_ERROR("Usage: echo <free lines to keep, 0 disables background GC> > gc\n");
+			NVMEV_ERROR("       echo policy <greedy|cost-benefit|d-choices|fifo> > gc\n");
+			NVMEV_ERROR("       echo hot <age in lines, 0 disables hot/cold separation> > gc\n");
+			return -EINVAL;
+		}
+
+		for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+			struct conv_ftl *conv_ftls = nvmev_vdev->ns[i].ftls;
+
+			if (NS_SSD_TYPE(i) != SSD_TYPE_CONV)
+				continue;
+
+			for (j = 0; j < nvmev_vdev->ns[i].nr_parts; j++) {
+				if (policy < NR_GC_POLICIES)
+					WRITE_ONCE(conv_ftls[j].cp.gc_policy, policy);
+				else
+					WRITE_ONCE(conv_ftls[j].cp.bg_gc_thres_lines, nr_lines);
+			}
+		}
+	} else if (!strcmp(filename, "wear")) {
+		unsigned int nr_erases;
+		int i, j;
+
+		if (sscanf(input, "%u", &nr_erases) != 1) {
+			NVMEV_ERROR("Usage: echo <erase count spread, 0 disables static wear leveling> > wear\n");
+			return -EINVAL;
+		}
+
+		for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+			struct conv_ftl *conv_ftls = nvmev_vdev->ns[i].ftls;
+
+			if (NS_SSD_TYPE(i) != SSD_TYPE_CONV)
+				continue;
+
+			for (j = 0; j < nvmev_vdev->ns[i].nr_parts; j++)
+				WRITE_ONCE(conv_ftls[j].cp.wl_thres_erases, nr_erases);
+		}
 	} else if (!strcmp(filename, "debug")) {
-		/* Left for later use */
+		unsigned int nr_reqs;
+		int i;
+
+		if (sscanf(input, "sched_bench %u", &nr_reqs) == 1) {
+			nvmev_sched_bench(nr_reqs);
+			goto out;
+		}
+		if (!strncmp(input, "copy_bench", 10)) {
+			nvmev_copy_bench();
+			goto out;
+		}
+		if (!strncmp(input, "nt_bench", 8)) {
+			nvmev_nt_bench();
+			goto out;
+		}
+
+		/* Anything else resets the counters */
+		for (i = 0; i < cfg->nr_dispatchers; i++) {
+			nvmev_vdev->dispatchers[i].nr_cmds = 0;
+			nvmev_vdev->dispatchers[i].nr_cycles = 0;
+		}
+		for (i = 0; i < cfg->nr_io_workers; i++)
+			memset(nvmev_vdev->io_workers[i].lateness, 0,
+			       sizeof(nvmev_vdev->io_workers[i].lateness));
 	}
 
 out:
@@ -488,6 +871,7 @@ static void NVMEV_STORAGE_INIT(struct nvmev_dev *nvmev_vdev)
 
 	nvmev_vdev->io_unit_stat = kzalloc(
 		sizeof(*nvmev_vdev->io_unit_stat) * nvmev_vdev->config.nr_io_units, GFP_KERNEL);
+	spin_lock_init(&nvmev_vdev->io_unit_lock);
 
 	nvmev_vdev->storage_mapped = memremap(nvmev_vdev->config.storage_start,
 					      nvmev_vdev->config.storage_size, MEMREMAP_WB);
@@ -505,7 +889,11 @@ static void NVMEV_STORAGE_INIT(struct nvmev_dev *nvmev_vdev)
 	nvmev_vdev->proc_io_units =
 		proc_create("io_units", 0664, nvmev_vdev->proc_root, &proc_file_fops);
 	nvmev_vdev->proc_stat = proc_create("stat", 0444, nvmev_vdev->proc_root, &proc_file_fops);
-	nvmev_vdev->proc_debug = proc_create("debug", 0444, nvmev_vdev->proc_root, &proc_file_fops);
+	nvmev_vdev->proc_debug = proc_create("debug", 0664, nvmev_vdev->proc_root, &proc_file_fops);
+	nvmev_vdev->proc_copy_mode =
+		proc_create("copy_mode", 0664, nvmev_vdev->proc_root, &proc_file_fops);
+	nvmev_vdev->proc_gc = proc_create("gc", 0664, nvmev_vdev->proc_root, &proc_file_fops);
+	nvmev_vdev->proc_wear = proc_create("wear", 0664, nvmev_vdev->proc_root, &proc_file_fops);
 
 	NVMEV_INFO("Create proc files in /proc/nvmev/");
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
@@ -519,6 +907,9 @@ static void NVMEV_STORAGE_FINAL(struct nvmev_dev *nvmev_vdev)
 	remove_proc_entry("io_units", nvmev_vdev->proc_root);
 	remove_proc_entry("stat", nvmev_vdev->proc_root);
 	remove_proc_entry("debug", nvmev_vdev->proc_root);
+	remove_proc_entry("copy_mode", nvmev_vdev->proc_root);
+	remove_proc_entry("gc", nvmev_vdev->proc_root);
+	remove_proc_entry("wear", nvmev_vdev->proc_root);
 
 	remove_proc_entry("nvmev", NULL);
 
@@ -533,7 +924,6 @@ static void NVMEV_STORAGE_FINAL(struct nvmev_dev *nvmev_vdev)
 static bool __load_configs(struct nvmev_config *config)
 {
 	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
-	bool first = true;
 	unsigned int cpu_nr;
 	char *cpu;
 
@@ -561,19 +951,29 @@ static bool __load_configs(struct nvmev_config *config)
 	config->nr_io_units = nr_io_units;
 	config->io_unit_shift = io_unit_shift;
 
+	config->worker_sleep = worker_sleep;
+	config->worker_spin_ns = worker_spin_ns;
+
 	config->nr_io_workers = 0;
+	config->nr_dispatchers = 0;
 	config->cpu_nr_dispatcher = -1;
 
 	while ((cpu = strsep(&cpus, ",")) != NULL) {
 		cpu_nr = (unsigned int)simple_strtol(cpu, NULL, 10);
-		if (first) {
-			config->cpu_nr_dispatcher = cpu_nr;
+		if (config->nr_dispatchers < nr_dispatchers) {
+			config->cpu_nr_dispatchers[config->nr_dispatchers] = cpu_nr;
+			config->nr_dispatchers++;
 		} else {
 			config->cpu_nr_io_workers[config->nr_io_workers] = cpu_nr;
 			config->nr_io_workers++;
 		}
-		first = false;
 	}
+
+	if (config->nr_dispatchers == 0) {
+		config->cpu_nr_dispatchers[0] = -1;
+		config->nr_dispatchers = 1;
+	}
+	config->cpu_nr_dispatcher = config->cpu_nr_dispatchers[0];
 	NVMEV_INFO("memmap_start %lx\n", config->memmap_start);
 	NVMEV_INFO("memmap_size %lx\n", config->memmap_size);
 	NVMEV_INFO("storage_start %lx\n", config->storage_start);
@@ -588,6 +988,9 @@ static bool __load_configs(struct nvmev_config *config)
 	NVMEV_INFO("io_unit_shift %u\n", config->io_unit_shift);
 	NVMEV_INFO("nr_io_workers %u\n", config->nr_io_workers);
 	NVMEV_INFO("cpu_nr_dispatcher %u\n", config->cpu_nr_dispatcher);
+	NVMEV_INFO("nr_dispatchers %u\n", config->nr_dispatchers);
+	NVMEV_INFO("worker_sleep %d, worker_spin_ns %u\n", config->worker_sleep,
+		   config->worker_spin_ns);
 
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 
@@ -612,6 +1015,7 @@ static void NVMEV_NAMESPACE_INIT(struct nvmev_dev *nvmev_vdev)
 		else
 			size = min(NS_CAPACITY(i), remaining_capacity);
 		NVMEV_INFO("init [%d] namespace,size[%lld], ns_addr[%p], disp_no[%d]\n",i,size, ns_addr, disp_no);
+		ns[i].proc_idle = NULL;
 		if (NS_SSD_TYPE(i) == SSD_TYPE_NVM)
 			simple_init_namespace(&ns[i], i, size, ns_addr, disp_no);
 		else if (NS_SSD_TYPE(i) == SSD_TYPE_CONV)
@@ -624,6 +1028,25 @@ static void NVMEV_NAMESPACE_INIT(struct nvmev_dev *nvmev_vdev)
 		else
 			BUG_ON(1);
 
+		ns[i].copy_mode = copy_mode & NVMEV_COPY_MODE_MASK;
+		ns[i].streams_enabled = false;
+		ns[i].nr_streams = 0;
+
+		/*
+		 * Nothing has been written yet, so everything reads as zeroes.
+		 * Cover the whole backing region: conv reports less than it
+		 * takes, and the OP tail is still addressable by the FTL.
+		 */
+		ns[i].zero_bitmap = NULL;
+		spin_lock_init(&ns[i].zero_lock);
+		if (NS_SSD_TYPE(i) != SSD_TYPE_KV) {
+			ns[i].nr_zero_bits = DIV_ROUND_UP(size, NVMEV_ZERO_SIZE);
+			ns[i].zero_bitmap =
+				vmalloc(BITS_TO_LONGS(ns[i].nr_zero_bits) * sizeof(unsigned long));
+			if (ns[i].zero_bitmap)
+				bitmap_fill(ns[i].zero_bitmap, ns[i].nr_zero_bits);
+		}
+
 		remaining_capacity -= size;
 		ns_addr += size;
 		NVMEV_INFO("ns %d/%d: size %lld MiB\n", i, nr_ns, BYTE_TO_MB(ns[i].size));
@@ -653,6 +1076,8 @@ static void NVMEV_NAMESPACE_FINAL(struct nvmev_dev *nvmev_vdev)
 			kv_remove_namespace(&ns[i]);
 		else
 			BUG_ON(1);
+
+		vfree(ns[i].zero_bitmap);
 	}
 
 	kfree(ns);
@@ -711,7 +1136,8 @@ static int NVMeV_init(void)
 	NVMEV_INFO("#### storage and namespace initialization complete ####\n");
 
 	if (io_using_dma) {
-		if (ioat_dma_chan_set("dma7chan0") != 0) {
+		/* Take every memcpy-capable channel, or emulate one in software */
+		if (ioat_dma_chan_set("") != 0 && ioat_dma_soft_init() != 0) {
 			io_using_dma = false;
 			NVMEV_ERROR("Cannot use DMA engine, Fall back to memcpy\n");
 		}
@@ -725,8 +1151,12 @@ static int NVMeV_init(void)
 
 	NVMEV_INFO("hardware initialization complete ####\n");
 
-	NVMEV_IO_WORKER_INIT(nvmev_vdev);
-	NVMEV_DISPATCHER_INIT(nvmev_vdev);
+	if (!NVMEV_IO_WORKER_INIT(nvmev_vdev))
+		goto ret_err_bus;
+	if (!NVMEV_DISPATCHER_INIT(nvmev_vdev)) {
+		NVMEV_IO_WORKER_FINAL(nvmev_vdev);
+		goto ret_err_bus;
+	}
 
 	NVMEV_INFO("pci add dev ...");
 	pci_bus_add_devices(nvmev_vdev->virt_bus);
@@ -736,6 +1166,12 @@ static int NVMeV_init(void)
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end\n", __FILE__, __LINE__, __FUNCTION__);
 	return 0;
 
+ret_err_bus:
+	pci_remove_root_bus(nvmev_vdev->virt_bus);
+	NVMEV_NAMESPACE_FINAL(nvmev_vdev);
+	NVMEV_STORAGE_FINAL(nvmev_vdev);
+	if (io_using_dma)
+		ioat_dma_cleanup();
 ret_err:
 	VDEV_FINALIZE(nvmev_vdev);
 	NVMEV_INFO("file: [%s]-[%d]-[%s] end err\n", __FILE__, __LINE__, __FUNCTION__);
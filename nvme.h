@@ -143,7 +143,12 @@ enum {
 	NVME_CTRL_ONCS_COMPARE = 1 << 0,
 	NVME_CTRL_ONCS_WRITE_UNCORRECTABLE = 1 << 1,
 	NVME_CTRL_ONCS_DSM = 1 << 2,
+	NVME_CTRL_ONCS_WRITE_ZEROES = 1 << 3,
+	NVME_CTRL_ONCS_COPY = 1 << 8,
 	NVME_CTRL_VWC_PRESENT = 1 << 0,
+	NVME_CTRL_OACS_DIRECTIVES = 1 << 5,
+	NVME_CTRL_OACS_DBBUF_SUPP = 1 << 8,
+	NVME_CTRL_SGLS_BYTE_ALIGNED = 1,
 };
 
 struct nvme_lbaf {
@@ -174,7 +179,15 @@ struct nvme_id_ns {
 	__le16 nabspf;
 	__u16 rsvd46;
 	__le64 nvmcap[2];
-	__u8 rsvd64[40];
+	__le16 npwg;
+	__le16 npwa;
+	__le16 npdg;
+	__le16 npda;
+	__le16 nows;
+	__le16 mssrl;
+	__le32 mcl;
+	__u8 msrc;
+	__u8 rsvd81[23];
 	__u8 nguid[16];
 	__u8 eui64[8];
 	struct nvme_lbaf lbaf[16];
@@ -317,6 +330,7 @@ struct nvme_reservation_status {
 	op(nvme_cmd_resv_report, 0x0e)		\
 	op(nvme_cmd_resv_acquire, 0x11)		\
 	op(nvme_cmd_resv_release, 0x15)		\
+	op(nvme_cmd_copy, 0x19)			\
 	op(nvme_cmd_zone_mgmt_send, 0x79)	\
 	op(nvme_cmd_zone_mgmt_recv, 0x7a)	\
 	op(nvme_cmd_zone_append, 0x7d) \
@@ -343,6 +357,27 @@ static const char *const __nvme_opcode_strings[] = {
 #define nvme_opcode_string(opcode) \
 	(__nvme_opcode_strings[opcode] ? __nvme_opcode_strings[opcode] : "unknown")
 
+/* PSDT: how the data pointer of a command is to be read */
+enum {
+	NVME_CMD_SGL_METABUF = (1 << 6),
+	NVME_CMD_SGL_METASEG = (1 << 7),
+	NVME_CMD_SGL_ALL = NVME_CMD_SGL_METABUF | NVME_CMD_SGL_METASEG,
+};
+
+enum {
+	NVME_SGL_FMT_ADDRESS = 0x00,
+	NVME_SGL_FMT_DATA_DESC = 0x00,
+	NVME_SGL_FMT_SEG_DESC = 0x02,
+	NVME_SGL_FMT_LAST_SEG_DESC = 0x03,
+};
+
+struct nvme_sgl_desc {
+	__le64 addr;
+	__le32 length;
+	__u8 rsvd[3];
+	__u8 type;
+};
+
 struct nvme_common_command {
 	__u8 opcode;
 	__u8 flags;
@@ -447,8 +482,82 @@ struct nvme_dsm_range {
 	__le64 slba;
 };
 
+struct nvme_copy_command {
+	__u8 opcode;
+	__u8 flags;
+	__u16 command_id;
+	__le32 nsid;
+	__u64 rsvd2[2];
+	__le64 prp1;
+	__le64 prp2;
+	__le64 sdlba;
+	__u8 nr_range; /* 0's based */
+	__u8 format;
+	__le16 control;
+	__le16 rsvd13;
+	__le16 dspec;
+	__le32 ilbrt;
+	__le16 lbat;
+	__le16 lbatm;
+};
+
+/* Source range entry, format 0h */
+struct nvme_copy_range {
+	__le64 rsvd0;
+	__le64 slba;
+	__le16 nlb; /* 0's based */
+	__le16 rsvd18;
+	__le32 rsvd20;
+	__le32 eilbrt;
+	__le16 elbat;
+	__le16 elbatm;
+};
+
 /* Admin commands */
 
+enum {
+	NVME_DIR_IDENTIFY = 0x00,
+	NVME_DIR_STREAMS = 0x01,
+	NVME_DIR_SND_ID_OP_ENABLE = 0x01,
+	NVME_DIR_SND_ST_OP_REL_ID = 0x01,
+	NVME_DIR_SND_ST_OP_REL_RSC = 0x02,
+	NVME_DIR_RCV_ID_OP_PARAM = 0x01,
+	NVME_DIR_RCV_ST_OP_PARAM = 0x01,
+	NVME_DIR_RCV_ST_OP_STATUS = 0x02,
+	NVME_DIR_RCV_ST_OP_RESOURCE = 0x03,
+	NVME_DIR_ENDIR = 0x01,
+};
+
+struct nvme_directive_cmd {
+	__u8 opcode;
+	__u8 flags;
+	__u16 command_id;
+	__le32 nsid;
+	__u64 rsvd2[2];
+	__le64 prp1;
+	__le64 prp2;
+	__le32 numd;
+	__u8 doper;
+	__u8 dtype;
+	__le16 dspec;
+	__u8 endir;
+	__u8 tdtype;
+	__u16 rsvd15;
+	__u32 rsvd16[3];
+};
+
+struct streams_directive_params {
+	__le16 msl;
+	__le16 nssa;
+	__le16 nsso;
+	__u8 rsvd[10];
+	__le32 sws;
+	__le16 sgs;
+	__le16 nsa;
+	__le16 nso;
+	__u8 rsvd2[6];
+};
+
 enum nvme_admin_opcode {
 	nvme_admin_delete_sq = 0x00,
 	nvme_admin_create_sq = 0x01,
@@ -628,6 +737,8 @@ struct nvme_command {
 		struct nvme_download_firmware dlfw;
 		struct nvme_format_cmd format;
 		struct nvme_dsm_cmd dsm;
+		struct nvme_copy_command copy;
+		struct nvme_directive_cmd directive;
 		struct nvme_abort_cmd abort;
 	};
 };
@@ -682,6 +793,7 @@ enum {
 	NVME_SC_BAD_ATTRIBUTES = 0x180,
 	NVME_SC_INVALID_PI = 0x181,
 	NVME_SC_READ_ONLY = 0x182,
+	NVME_SC_CMD_SIZE_LIMIT = 0x183,
 	NVME_SC_WRITE_FAULT = 0x280,
 	NVME_SC_READ_ERROR = 0x281,
 	NVME_SC_GUARD_CHECK = 0x282,
@@ -98,6 +98,11 @@ struct nvmev_sq_stat {
 	unsigned long long total_io;
 };
 
+struct nvmev_cq_stat {
+	unsigned long long nr_cqes;
+	unsigned long long nr_irqs;
+};
+
 struct nvmev_submission_queue {
 	int qid;
 	int cqid;
@@ -119,6 +124,9 @@ struct nvmev_completion_queue {
 	bool interrupt_ready;
 	bool phys_contig;
 
+	unsigned int nr_pending_irq; /* CQEs posted since the last interrupt */
+	unsigned long long nsecs_first_pending; /* When the oldest of them completed */
+
 	spinlock_t entry_lock;
 	struct mutex irq_lock;
 
@@ -128,6 +136,8 @@ struct nvmev_completion_queue {
 	int cq_head;
 	int cq_tail;
 
+	struct nvmev_cq_stat stat;
+
 	struct nvme_completion __iomem **cq;
 	void *mapped;
 };
@@ -160,9 +170,13 @@ struct nvmev_config {
 	unsigned long storage_start; //byte 虚拟设备的开始地址
 	unsigned long storage_size; // byte 虚拟设备的size
 
-	unsigned int cpu_nr_dispatcher;// 调度器cpu编号
+	unsigned int cpu_nr_dispatcher;// 调度器cpu编号, also the reference clock
+	unsigned int nr_dispatchers;
+	unsigned int cpu_nr_dispatchers[32];
 	unsigned int nr_io_workers;//IO cpu数量
 	unsigned int cpu_nr_io_workers[32];//IO cpu编号
+	bool worker_sleep; /* Sleep on an hrtimer until the next completion instead of polling */
+	unsigned int worker_spin_ns; /* Deadlines closer than this are still busy-waited */
 
 	/* TODO Refactoring storage configurations */
 	unsigned int nr_io_units;
@@ -192,7 +206,7 @@ struct nvmev_io_work {
 	unsigned long long nsecs_cq_filled;
 
 	bool is_copied;
-	bool is_completed;
+	atomic_t nr_dma_pending; /* DMA copies in flight, plus one while submitting */
 
 	unsigned int status;
 	unsigned int result0;
@@ -202,24 +216,66 @@ struct nvmev_io_work {
 	void *write_buffer;
 	size_t buffs_to_release;
 
-	unsigned int next, prev;
+	unsigned int next; /* Chains the completion batch of a CQ */
+};
+
+/* Completion lateness buckets: <1us, <2us, <4us, ..., and the rest */
+#define NR_LATENESS_BUCKETS 16
+
+struct nvmev_io_ring {
+	unsigned int size; /* Power of 2 */
+	unsigned int *entries;
+
+	/* Consumer side */
+	unsigned int head ____cacheline_aligned_in_smp;
+	unsigned int tail_cached; /* Last @tail seen; reloaded only when drained */
+
+	/* Producer side */
+	unsigned int tail ____cacheline_aligned_in_smp;
+	unsigned int tail_staged; /* Entries written but not yet published to @tail */
+	unsigned int head_cached; /* Last @head seen; reloaded only when full */
 };
 
 struct nvmev_io_worker {
 	struct nvmev_io_work *work_queue;
 
-	unsigned int free_seq; /* free io req head index */
-	unsigned int free_seq_end; /* free io req tail index */
-	unsigned int io_seq; /* io req head index */
-	unsigned int io_seq_end; /* io req tail index */
+	/*
+	 * A ring pair per dispatcher. Each dispatcher owns a slice of @work_queue,
+	 * takes free entries from its @free_rings and pushes filled ones to its
+	 * @submit_rings. The worker pushes completed entries back to the owner.
+	 */
+	struct nvmev_io_ring *submit_rings;
+	struct nvmev_io_ring *free_rings;
+	unsigned int nr_entries_per_dispatcher;
+
+	unsigned int *heap; /* Min-heap of in-flight reqs by nsecs_target, worker private */
+	unsigned int nr_heap;
 
-	unsigned long long latest_nsecs;
+	/* Completions gathered in a pass, chained per CQ; worker private */
+	unsigned int batch_head[NR_MAX_IO_QUEUE + 1];
+	unsigned int batch_tail[NR_MAX_IO_QUEUE + 1];
+	unsigned int batch_cqids[NR_MAX_IO_QUEUE + 1];
+	unsigned int nr_batch_cqs;
+
+	bool sleeping; /* Dispatchers shall wake it up on a new submission */
+	unsigned long long lateness[NR_LATENESS_BUCKETS];
 
 	unsigned int id;
 	struct task_struct *task_struct;
 	char thread_name[32];
 };
 
+struct nvmev_dispatcher {
+	unsigned int id;
+	unsigned long nr_loops; /* Bumped at the end of every polling round */
+
+	unsigned long long nr_cmds; /* I/O commands dispatched */
+	unsigned long long nr_cycles; /* get_cycles() spent on dispatching them */
+
+	struct task_struct *task_struct;
+	char thread_name[32];
+};
+
 struct nvmev_dev {
 	struct pci_bus *virt_bus;
 	void *virtDev;
@@ -232,7 +288,7 @@ struct nvmev_dev {
 	struct pci_dev *pdev;
 
 	struct nvmev_config config;
-	struct task_struct *nvmev_dispatcher;
+	struct nvmev_dispatcher *dispatchers;
 
 	void *storage_mapped;
 
@@ -249,6 +305,13 @@ struct nvmev_dev {
 	u32 *old_dbs;
 	u32 __iomem *dbs;
 
+	/*
+	 * Shadow doorbells and EventIdx in host memory, set by the Doorbell Buffer
+	 * Config command. Laid out like @dbs; NULL until the host configures them.
+	 */
+	u32 *dbbuf_dbs;
+	u32 *dbbuf_eis;
+
 	struct nvmev_ns *ns;// NVME namespace
 	unsigned int nr_ns; // namespace number
 	unsigned int nr_sq; // submission queue number
@@ -260,14 +323,23 @@ struct nvmev_dev {
 
 	unsigned int mdts;//Maximum Data Transfer Size
 
+	/* Interrupt Coalescing and Interrupt Vector Configuration features */
+	unsigned int irq_aggr_thr; /* 0's based number of CQEs */
+	unsigned int irq_aggr_time; /* In 100us */
+	DECLARE_BITMAP(irq_coalesce_disabled, NR_MAX_IO_QUEUE + 1);
+
 	struct proc_dir_entry *proc_root;
 	struct proc_dir_entry *proc_read_times;
 	struct proc_dir_entry *proc_write_times;
 	struct proc_dir_entry *proc_io_units;
 	struct proc_dir_entry *proc_stat;
 	struct proc_dir_entry *proc_debug;
+	struct proc_dir_entry *proc_copy_mode;
+	struct proc_dir_entry *proc_gc;
+	struct proc_dir_entry *proc_wear;
 
 	unsigned long long *io_unit_stat;
+	spinlock_t io_unit_lock;
 };
 
 struct nvmev_request {
@@ -281,11 +353,39 @@ struct nvmev_result {
 	uint64_t nsecs_target;
 };
 
+/* How data are copied to and from the storage of a namespace */
+enum {
+	NVMEV_COPY_MEMCPY = 0,
+	NVMEV_COPY_NOCACHE = 1 << 0, /* Non-temporal stores for writes */
+	NVMEV_COPY_PREFETCH = 1 << 1, /* Prefetch ahead for reads */
+	NVMEV_COPY_MODE_MASK = NVMEV_COPY_NOCACHE | NVMEV_COPY_PREFETCH,
+	NVMEV_COPY_ZERO = 1 << 7, /* Fill the host buffer with zeroes instead */
+};
+
+/* Granule of the zero bitmap of a namespace */
+#define NVMEV_ZERO_SHIFT 12
+#define NVMEV_ZERO_SIZE (1UL << NVMEV_ZERO_SHIFT)
+
+/* Copy command limits in LBAs, advertised in Identify Namespace */
+#define NVMEV_MSSRL 2048 /* Per source range */
+#define NVMEV_MCL 8192 /* Per command */
+#define NVMEV_MSRC 127 /* Source ranges per command, 0's based */
+
 struct nvmev_ns {
 	uint32_t id;
 	uint32_t csi;
 	uint64_t size;
 	void *mapped;
+	unsigned int copy_mode;
+
+	/* Streams directive, set through the admin queue */
+	bool streams_enabled;
+	uint16_t nr_streams; /* Stream resources allocated to the namespace */
+
+	/* Granules that read as zeroes without their storage being cleared */
+	unsigned long *zero_bitmap;
+	unsigned long nr_zero_bits;
+	spinlock_t zero_lock;
 
 	/*conv ftl or zns or kv*/
 	uint32_t nr_parts; // partitions
@@ -294,6 +394,8 @@ struct nvmev_ns {
 	/*io command handler*/
 	bool (*proc_io_cmd)(struct nvmev_ns *ns, struct nvmev_request *req,
 			    struct nvmev_result *ret);
+	/* Background work, run by dispatchers with nothing to dispatch */
+	void (*proc_idle)(struct nvmev_ns *ns);
 
 	/*specific CSS io command identifier*/
 	bool (*identify_io_cmd)(struct nvmev_ns *ns, struct nvme_command cmd);
@@ -307,6 +409,9 @@ extern struct nvmev_dev *nvmev_vdev;
 struct nvmev_dev *VDEV_INIT(void);
 void VDEV_FINALIZE(struct nvmev_dev *nvmev_vdev);
 
+// OPS DISPATCHER
+void nvmev_sync_dispatchers(void);
+
 // OPS_PCI
 bool nvmev_proc_bars(void);
 bool NVMEV_PCI_INIT(struct nvmev_dev *dev);
@@ -315,14 +420,52 @@ void nvmev_signal_irq(int msi_index);
 // OPS ADMIN QUEUE
 void nvmev_proc_admin_sq(int new_db, int old_db);
 void nvmev_proc_admin_cq(int new_db, int old_db);
+void nvmev_dbbuf_update_event(int dbs_idx, int db, int queue_size);
+
+/* Walks the data pointer of a command, PRPs or SGL, in physically contiguous chunks */
+#define NR_SGL_DESCS_BATCH 16
+#define NR_MAX_SGL_SEGS 256
+
+struct nvmev_dptr_iter {
+	size_t remaining;
+	bool is_sgl;
+	u16 status;
+
+	/* PRP */
+	u64 prp1;
+	u64 prp2;
+	unsigned int nr_prps;
+	u64 *prp_list;
+	bool is_prp_list_memremap;
+
+	/* SGL; descriptors of the current segment are fetched in batches */
+	struct nvme_sgl_desc descs[NR_SGL_DESCS_BATCH];
+	unsigned int nr_descs;
+	unsigned int desc_idx;
+	u64 seg_addr;
+	unsigned int seg_left;
+	unsigned int nr_segs;
+	bool is_last_seg;
+};
+
+void nvmev_dptr_init(struct nvmev_dptr_iter *it, u8 flags, u64 dptr1, u64 dptr2, size_t length);
+bool nvmev_dptr_next(struct nvmev_dptr_iter *it, u64 *paddr, size_t *len);
+void nvmev_dptr_end(struct nvmev_dptr_iter *it);
+u16 nvmev_dptr_copy(u8 flags, u64 dptr1, u64 dptr2, void *buf, size_t length, bool to_dev,
+		    unsigned int copy_mode);
 
 // OPS I/O QUEUE
 struct buffer;
 void schedule_internal_operation(int sqid, unsigned long long nsecs_target,
 				struct buffer *write_buffer, size_t buffs_to_release);
-void NVMEV_IO_WORKER_INIT(struct nvmev_dev *nvmev_vdev);
+bool NVMEV_IO_WORKER_INIT(struct nvmev_dev *nvmev_vdev);
 void NVMEV_IO_WORKER_FINAL(struct nvmev_dev *nvmev_vdev);
-int nvmev_proc_io_sq(int qid, int new_db, int old_db);
-void nvmev_proc_io_cq(int qid, int new_db, int old_db);
+int nvmev_proc_io_sq(struct nvmev_submission_queue *sq, int qid, int new_db, int old_db);
+void nvmev_proc_io_cq(struct nvmev_completion_queue *cq, int qid, int new_db, int old_db);
+void nvmev_sched_bench(unsigned int nr_reqs);
+void nvmev_copy_bench(void);
+void nvmev_nt_bench(void);
+void nvmev_zero_range(struct nvmev_ns *ns, u64 offset, u64 len);
+void nvmev_move_range(struct nvmev_ns *ns, u64 dst, u64 src, u64 len);
 
 #endif /* _LIB_NVMEV_H */
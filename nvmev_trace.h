@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM nvmev
+
+#if !defined(_NVMEV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _NVMEV_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "nvme.h"
+
+/*
+ * Tracepoints on the I/O path. They compile down to a static-key branch that
+ * is never taken unless the event is enabled, e.g.,
+ *   echo 1 > /sys/kernel/tracing/events/nvmev/enable
+ *   cat /sys/kernel/tracing/trace_pipe
+ */
+
+TRACE_EVENT(nvmev_cmd_submit,
+	TP_PROTO(int sqid, int sq_entry, struct nvme_command *cmd,
+		 unsigned long long nsecs_start, unsigned long long nsecs_target),
+	TP_ARGS(sqid, sq_entry, cmd, nsecs_start, nsecs_target),
+
+	TP_STRUCT__entry(
+		__field(int, sqid)
+		__field(int, sq_entry)
+		__field(u8, opcode)
+		__field(u16, command_id)
+		__field(u32, nsid)
+		__field(u64, slba)
+		__field(u32, nr_lba)
+		__field(u64, nsecs_start)
+		__field(u64, nsecs_target)
+	),
+
+	TP_fast_assign(
+		__entry->sqid = sqid;
+		__entry->sq_entry = sq_entry;
+		__entry->opcode = cmd->common.opcode;
+		__entry->command_id = cmd->common.command_id;
+		__entry->nsid = cmd->common.nsid;
+		__entry->slba = cmd->rw.slba;
+		__entry->nr_lba = cmd->rw.length + 1;
+		__entry->nsecs_start = nsecs_start;
+		__entry->nsecs_target = nsecs_target;
+	),
+
+	TP_printk("sq=%d entry=%d cid=%u nsid=%u opcode=0x%x slba=%llu nlb=%u start=%llu target=%llu (+%llu)",
+		  __entry->sqid, __entry->sq_entry, __entry->command_id, __entry->nsid,
+		  __entry->opcode, __entry->slba, __entry->nr_lba, __entry->nsecs_start,
+		  __entry->nsecs_target, __entry->nsecs_target - __entry->nsecs_start)
+);
+
+TRACE_EVENT(nvmev_ftl_map,
+	TP_PROTO(u64 lpn, int ch, int lun, int blk, int pg),
+	TP_ARGS(lpn, ch, lun, blk, pg),
+
+	TP_STRUCT__entry(
+		__field(u64, lpn)
+		__field(int, ch)
+		__field(int, lun)
+		__field(int, blk)
+		__field(int, pg)
+	),
+
+	TP_fast_assign(
+		__entry->lpn = lpn;
+		__entry->ch = ch;
+		__entry->lun = lun;
+		__entry->blk = blk;
+		__entry->pg = pg;
+	),
+
+	TP_printk("lpn=%llu -> ch=%d lun=%d blk=%d pg=%d",
+		  __entry->lpn, __entry->ch, __entry->lun, __entry->blk, __entry->pg)
+);
+
+TRACE_EVENT(nvmev_nand_op,
+	TP_PROTO(int cmd, int ch, int lun, int blk, int pg, u64 xfer_size,
+		 u64 nsecs_start, u64 nsecs_completed),
+	TP_ARGS(cmd, ch, lun, blk, pg, xfer_size, nsecs_start, nsecs_completed),
+
+	TP_STRUCT__entry(
+		__field(int, cmd)
+		__field(int, ch)
+		__field(int, lun)
+		__field(int, blk)
+		__field(int, pg)
+		__field(u64, xfer_size)
+		__field(u64, nsecs_start)
+		__field(u64, nsecs_completed)
+	),
+
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->ch = ch;
+		__entry->lun = lun;
+		__entry->blk = blk;
+		__entry->pg = pg;
+		__entry->xfer_size = xfer_size;
+		__entry->nsecs_start = nsecs_start;
+		__entry->nsecs_completed = nsecs_completed;
+	),
+
+	/* Values follow NAND_READ, NAND_WRITE, ... in ssd.h */
+	TP_printk("%s ch=%d lun=%d blk=%d pg=%d size=%llu start=%llu done=%llu (+%llu)",
+		  __print_symbolic(__entry->cmd, { 0, "READ" }, { 1, "WRITE" },
+				   { 2, "ERASE" }, { 3, "NOP" }),
+		  __entry->ch, __entry->lun, __entry->blk, __entry->pg, __entry->xfer_size,
+		  __entry->nsecs_start, __entry->nsecs_completed,
+		  __entry->nsecs_completed - __entry->nsecs_start)
+);
+
+TRACE_EVENT(nvmev_cmd_complete,
+	TP_PROTO(int sqid, int cqid, unsigned int command_id, unsigned int status,
+		 unsigned long long nsecs_start, unsigned long long nsecs_target),
+	TP_ARGS(sqid, cqid, command_id, status, nsecs_start, nsecs_target),
+
+	TP_STRUCT__entry(
+		__field(int, sqid)
+		__field(int, cqid)
+		__field(unsigned int, command_id)
+		__field(unsigned int, status)
+		__field(u64, nsecs_start)
+		__field(u64, nsecs_target)
+	),
+
+	TP_fast_assign(
+		__entry->sqid = sqid;
+		__entry->cqid = cqid;
+		__entry->command_id = command_id;
+		__entry->status = status;
+		__entry->nsecs_start = nsecs_start;
+		__entry->nsecs_target = nsecs_target;
+	),
+
+	TP_printk("sq=%d cq=%d cid=%u status=0x%x target=%llu (+%llu)",
+		  __entry->sqid, __entry->cqid, __entry->command_id, __entry->status,
+		  __entry->nsecs_target, __entry->nsecs_target - __entry->nsecs_start)
+);
+
+TRACE_EVENT(nvmev_irq,
+	TP_PROTO(int msi_index, bool msix),
+	TP_ARGS(msi_index, msix),
+
+	TP_STRUCT__entry(
+		__field(int, msi_index)
+		__field(bool, msix)
+	),
+
+	TP_fast_assign(
+		__entry->msi_index = msi_index;
+		__entry->msix = msix;
+	),
+
+	TP_printk("%s vector=%d", __entry->msix ? "msix" : "intx", __entry->msi_index)
+);
+
+#endif /* _NVMEV_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE nvmev_trace
+
+#include <trace/define_trace.h>
@@ -9,6 +9,7 @@
 
 #include "nvmev.h"
 #include "pci.h"
+#include "nvmev_trace.h"
 
 #ifdef CONFIG_NVMEV_FAST_X86_IRQ_HANDLING
 static int apicid_to_cpuid[256];
@@ -24,7 +25,6 @@ static void __init_apicid_to_cpuid(void)
 
 static void __signal_irq(const char *type, unsigned int irq)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct irq_data *irqd = irq_get_irq_data(irq);
 	struct irq_cfg *irqc = irqd_cfg(irqd);
 
@@ -39,7 +39,6 @@ static void __signal_irq(const char *type, unsigned int irq)
 #else
 static void __signal_irq(const char *type, unsigned int irq)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	struct irq_data *data = irq_get_irq_data(irq);
 	struct irq_chip *chip = irq_data_get_irq_chip(data);
 
@@ -54,7 +53,6 @@ static void __signal_irq(const char *type, unsigned int irq)
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
 static void __process_msi_irq(int msi_index)
 {
-	NVMEV_INFO("file: [%s]-[%d]-[%s] start\n", __FILE__, __LINE__, __FUNCTION__);
 	unsigned int virq = msi_get_virq(&nvmev_vdev->pdev->dev, msi_index);
 
 	BUG_ON(virq == 0);
@@ -80,6 +78,8 @@ static void __process_msi_irq(int msi_index)
 void nvmev_signal_irq(int msi_index)
 {
 	// NVMEV_INFO("file: [%s]-[%s] start\n", __FILE__, __FUNCTION__);
+	trace_nvmev_irq(msi_index, nvmev_vdev->pdev->msix_enabled);
+
 	if (nvmev_vdev->pdev->msix_enabled) {
 		__process_msi_irq(msi_index);
 	} else {
@@ -259,6 +259,13 @@ bool nvmev_proc_bars(void)
 			}
 		} else if (bar->cc.en == 0) {
 			bar->csts.rdy = 0;
+
+			/* Controller reset clears the Doorbell Buffer Config and features */
+			WRITE_ONCE(nvmev_vdev->dbbuf_dbs, NULL);
+			WRITE_ONCE(nvmev_vdev->dbbuf_eis, NULL);
+			nvmev_vdev->irq_aggr_thr = 0;
+			nvmev_vdev->irq_aggr_time = 0;
+			bitmap_zero(nvmev_vdev->irq_coalesce_disabled, NR_MAX_IO_QUEUE + 1);
 		}
 
 		/* Shutdown */
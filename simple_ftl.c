@@ -81,6 +81,8 @@ bool simple_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req,
 	BUG_ON(ns->csi != NVME_CSI_NVM);
 	BUG_ON(BASE_SSD != INTEL_OPTANE);
 
+	/* io_unit_stat is shared by all dispatchers */
+	spin_lock(&nvmev_vdev->io_unit_lock);
 	switch (cmd->common.opcode) {
 	case nvme_cmd_write:
 	case nvme_cmd_read:
@@ -91,12 +93,26 @@ bool simple_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req,
 	case nvme_cmd_flush:
 		ret->nsecs_target = __schedule_flush(req);
 		break;
+	case nvme_cmd_write_zeroes:
+		if (cmd->rw.slba >= BYTE_TO_LBA(ns->size) ||
+		    cmd->rw.length + 1 > BYTE_TO_LBA(ns->size) - cmd->rw.slba) {
+			ret->status = NVME_SC_LBA_RANGE;
+			ret->nsecs_target = __get_wallclock();
+			break;
+		}
+		/* No data to move; only the command overhead is charged */
+		nvmev_zero_range(ns, cmd->rw.slba << LBA_BITS,
+				 __cmd_io_size((struct nvme_rw_command *)cmd));
+		ret->nsecs_target = __get_wallclock() + nvmev_vdev->config.write_delay;
+		break;
 	default:
 		NVMEV_ERROR("%s: command not implemented: %s (0x%x)\n", __func__,
 			    nvme_opcode_string(cmd->common.opcode), cmd->common.opcode);
 		break;
 	}
 
+	spin_unlock(&nvmev_vdev->io_unit_lock);
+
 	return true;
 }
 
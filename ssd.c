@@ -5,6 +5,7 @@
 
 #include "nvmev.h"
 #include "ssd.h"
+#include "nvmev_trace.h"
 
 static inline uint64_t __get_ioclock(struct ssd *ssd)
 {
@@ -363,6 +364,7 @@ static void ssd_init_pcie(struct ssd_pcie *pcie, struct ssdparams *spp)
 	pcie->perf_model = kmalloc(sizeof(struct channel_model), GFP_KERNEL);
 	NVMEV_INFO("init pcie ch perf model");
 	chmodel_init(pcie->perf_model, spp->pcie_bandwidth);
+	spin_lock_init(&pcie->lock);
 }
 
 static void ssd_remove_pcie(struct ssd_pcie *pcie)
@@ -418,7 +420,13 @@ void ssd_remove(struct ssd *ssd)
 uint64_t ssd_advance_pcie(struct ssd *ssd, uint64_t request_time, uint64_t length)
 {
 	struct channel_model *perf_model = ssd->pcie->perf_model;
-	return chmodel_request(perf_model, request_time, length);
+	uint64_t nsecs_completed;
+
+	spin_lock(&ssd->pcie->lock);
+	nsecs_completed = chmodel_request(perf_model, request_time, length);
+	spin_unlock(&ssd->pcie->lock);
+
+	return nsecs_completed;
 }
 
 /* Write buffer Performance Model
@@ -532,6 +540,9 @@ uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
 		return 0;
 	}
 
+	trace_nvmev_nand_op(c, ppa->g.ch, ppa->g.lun, ppa->g.blk, ppa->g.pg, ncmd->xfer_size,
+			    cmd_stime, completed_time);
+
 	return completed_time;
 }
 
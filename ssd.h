@@ -120,6 +120,7 @@ struct ssd_channel {
 
 struct ssd_pcie {
 	struct channel_model *perf_model;
+	spinlock_t lock; /* shared by all partitions and dispatchers */
 };
 
 struct nand_cmd {
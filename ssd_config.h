@@ -101,6 +101,7 @@ static_assert((ONESHOT_PAGE_SIZE % FLASH_PAGE_SIZE) == 0);
 #define FW_WBUF_LATENCY1 (460)
 #define FW_CH_XFER_LATENCY (0)
 #define OP_AREA_PERCENT (0.07)
+#define DFTL_CMT_SIZE (0) /* Bytes of cached mapping table (DFTL), 0 caches all of it */
 
 #define GLOBAL_WB_SIZE (NAND_CHANNELS * LUNS_PER_NAND_CH * ONESHOT_PAGE_SIZE * 2)
 #define WRITE_EARLY_COMPLETION 1
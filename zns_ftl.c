@@ -26,6 +26,7 @@ static void __init_descriptor(struct zns_ftl *zns_ftl)
 
 	if (zone_wb_size)
 		zns_ftl->zone_write_buffer = kmalloc(sizeof(struct buffer) * nr_zones, GFP_KERNEL);
+	zns_ftl->zone_nr_buffered = kcalloc(nr_zones, sizeof(uint32_t), GFP_KERNEL);
 
 	zone_descs = zns_ftl->zone_descs;
 
@@ -56,6 +57,7 @@ static void __remove_descriptor(struct zns_ftl *zns_ftl)
 
 	if (zns_ftl->zp.zone_wb_size)
 		kfree(zns_ftl->zone_write_buffer);
+	kfree(zns_ftl->zone_nr_buffered);
 
 	kfree(zns_ftl->report_buffer);
 	kfree(zns_ftl->zone_descs);
@@ -116,6 +118,8 @@ static void zns_init_ftl(struct zns_ftl *zns_ftl, struct znsparams *zpp, struct
 		.storage_base_addr = mapped_addr,
 	};
 
+	spin_lock_init(&zns_ftl->lock);
+
 	__init_descriptor(zns_ftl);
 	__init_resource(zns_ftl);
 }
@@ -189,19 +193,26 @@ static void zns_flush(struct nvmev_ns *ns, struct nvmev_request *req, struct nvm
 bool zns_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
 {
 	struct nvme_command *cmd = req->cmd;
+	struct zns_ftl *zns_ftl = (struct zns_ftl *)ns->ftls;
+	bool success = true;
 	NVMEV_ASSERT(ns->csi == NVME_CSI_ZNS);
 	/*still not support multi partitions ...*/
 	NVMEV_ASSERT(ns->nr_parts == 1);
 
+	spin_lock(&zns_ftl->lock);
 	switch (cmd->common.opcode) {
 	case nvme_cmd_write:
 	case nvme_cmd_zone_append:
-		if (!zns_write(ns, req, ret))
-			return false;
+		success = zns_write(ns, req, ret);
+		break;
+	case nvme_cmd_write_zeroes:
+		success = zns_write_zeroes(ns, req, ret);
 		break;
 	case nvme_cmd_read:
-		if (!zns_read(ns, req, ret))
-			return false;
+		success = zns_read(ns, req, ret);
+		break;
+	case nvme_cmd_copy:
+		success = zns_copy(ns, req, ret);
 		break;
 	case nvme_cmd_flush:
 		zns_flush(ns, req, ret);
@@ -217,6 +228,7 @@ bool zns_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struct
 			    nvme_opcode_string(cmd->common.opcode), cmd->common.opcode);
 		break;
 	}
+	spin_unlock(&zns_ftl->lock);
 
-	return true;
+	return success;
 }
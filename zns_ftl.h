@@ -40,8 +40,10 @@ struct zns_ftl {
 	struct zone_descriptor *zone_descs;
 	struct zone_report *report_buffer;
 	struct buffer *zone_write_buffer;
+	uint32_t *zone_nr_buffered; /* Pages of each zone's open wordline that hold write buffer */
 	struct buffer *zrwa_buffer;
 	void *storage_base_addr;
+	spinlock_t lock; /* Serializes the dispatchers issuing commands to this namespace */
 };
 
 /* zns internal functions */
@@ -116,6 +118,14 @@ static inline uint64_t zone_to_elpn(struct zns_ftl *zns_ftl, uint32_t zid)
 	return zone_to_elba(zns_ftl, zid) / zns_ftl->ssd->sp.secs_per_pg;
 }
 
+/* The write buffer that host writes to zone @zid take */
+static inline struct buffer *zone_to_write_buffer(struct zns_ftl *zns_ftl, uint32_t zid)
+{
+	if (zns_ftl->zp.zone_wb_size)
+		return &zns_ftl->zone_write_buffer[zid];
+	return zns_ftl->ssd->write_buffer;
+}
+
 static inline uint32_t die_to_channel(struct zns_ftl *zns_ftl, uint32_t die)
 {
 	return (die) % zns_ftl->ssd->sp.nchs;
@@ -140,5 +150,7 @@ void zns_zmgmt_recv(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev
 void zns_zmgmt_send(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
 bool zns_write(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
 bool zns_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
+bool zns_write_zeroes(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
+bool zns_copy(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
 bool zns_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
 #endif
@@ -10,66 +10,6 @@
 #include "ssd.h"
 #include "zns_ftl.h"
 
-static uint64_t __prp_transfer_data(uint64_t prp1, uint64_t prp2, void *buffer, uint64_t length,
-				    uint32_t io)
-{
-	size_t offset;
-	size_t remaining;
-	size_t prp_offs = 0;
-	size_t prp2_offs = 0;
-	uint64_t paddr;
-	uint64_t *paddr_list = NULL;
-	size_t mem_offs = 0;
-
-	offset = 0;
-	remaining = length;
-
-	while (remaining) {
-		size_t io_size;
-		void *vaddr;
-
-		mem_offs = 0;
-		prp_offs++;
-		if (prp_offs == 1) {
-			paddr = prp1;
-		} else if (prp_offs == 2) {
-			paddr = prp2;
-			if (remaining > PAGE_SIZE) {
-				paddr_list = kmap_atomic_pfn(PRP_PFN(paddr)) +
-					     (paddr & PAGE_OFFSET_MASK);
-				paddr = paddr_list[prp2_offs++];
-			}
-		} else {
-			paddr = paddr_list[prp2_offs++];
-		}
-
-		vaddr = kmap_atomic_pfn(PRP_PFN(paddr));
-
-		io_size = min_t(size_t, remaining, PAGE_SIZE);
-
-		if (paddr & PAGE_OFFSET_MASK) {
-			mem_offs = paddr & PAGE_OFFSET_MASK;
-			if (io_size + mem_offs > PAGE_SIZE)
-				io_size = PAGE_SIZE - mem_offs;
-		}
-
-		if (io == 0) // output (buffer -> prp)
-			memcpy(vaddr + mem_offs, buffer + offset, io_size);
-		else // input (prp -> buffer)
-			memcpy(buffer + offset, vaddr + mem_offs, io_size);
-
-		kunmap_atomic(vaddr);
-
-		remaining -= io_size;
-		offset += io_size;
-	}
-
-	if (paddr_list != NULL)
-		kunmap_atomic(paddr_list);
-
-	return length;
-}
-
 static void __fill_zone_report(struct zns_ftl *zns_ftl, struct nvme_zone_mgmt_recv *cmd,
 			       struct zone_report *report)
 {
@@ -124,8 +64,6 @@ void zns_zmgmt_recv(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev
 	struct zone_report *buffer = zns_ftl->report_buffer;
 	struct nvme_zone_mgmt_recv *cmd = (struct nvme_zone_mgmt_recv *)req->cmd;
 
-	uint64_t prp1 = (uint64_t)cmd->prp1;
-	uint64_t prp2 = (uint64_t)cmd->prp2;
 	uint64_t length = (cmd->nr_dw + 1) * sizeof(uint32_t);
 	uint32_t status;
 
@@ -136,8 +74,8 @@ void zns_zmgmt_recv(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev
 	if (__check_zmgmt_rcv_option_supported(zns_ftl, cmd)) {
 		__fill_zone_report(zns_ftl, cmd, buffer);
 
-		__prp_transfer_data(prp1, prp2, buffer, length, 0);
-		status = NVME_SC_SUCCESS;
+		status = nvmev_dptr_copy(cmd->flags, cmd->prp1, cmd->prp2, buffer, length, false,
+					 NVMEV_COPY_MEMCPY);
 	} else {
 		status = NVME_SC_INVALID_FIELD;
 	}
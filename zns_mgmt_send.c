@@ -105,7 +105,7 @@ static uint32_t __zmgmt_send_open_zone(struct zns_ftl *zns_ftl, uint64_t zid, ui
 	return status;
 }
 
-static void __reset_zone(struct zns_ftl *zns_ftl, uint64_t zid)
+static void __reset_zone(struct nvmev_ns *ns, struct zns_ftl *zns_ftl, uint64_t zid)
 {
 	struct zone_descriptor *zone_descs = zns_ftl->zone_descs;
 	uint32_t zone_size = zns_ftl->zp.zone_size;
@@ -114,16 +114,24 @@ static void __reset_zone(struct zns_ftl *zns_ftl, uint64_t zid)
 	NVMEV_ZNS_DEBUG("%s zid %llu start addres 0x%llx zone_size %x \n", __func__,
 			zid, (uint64_t)zone_start_addr, zone_size);
 
-	memset(zone_start_addr, 0, zone_size);
+	nvmev_zero_range(ns, zone_start_addr - (uint8_t *)ns->mapped, zone_size);
 
 	zone_descs[zid].wp = zone_descs[zid].zslba;
 	zone_descs[zid].zrwav = 0;
 
+	/* Data of a partial wordline are dropped without being programmed */
+	if (zns_ftl->zone_nr_buffered[zid]) {
+		buffer_release(zone_to_write_buffer(zns_ftl, zid),
+			       zns_ftl->zone_nr_buffered[zid] * zns_ftl->ssd->sp.pgsz);
+		zns_ftl->zone_nr_buffered[zid] = 0;
+	}
+
 	if (zns_ftl->zp.zrwa_buffer_size)
 		buffer_refill(&zns_ftl->zrwa_buffer[zid]);
 }
 
-static uint32_t __zmgmt_send_reset_zone(struct zns_ftl *zns_ftl, uint64_t zid)
+static uint32_t __zmgmt_send_reset_zone(struct nvmev_ns *ns, struct zns_ftl *zns_ftl,
+					uint64_t zid)
 {
 	struct zone_descriptor *zone_descs = zns_ftl->zone_descs;
 	enum zone_state cur_state = zone_descs[zid].state;
@@ -144,7 +152,7 @@ static uint32_t __zmgmt_send_reset_zone(struct zns_ftl *zns_ftl, uint64_t zid)
 	case ZONE_STATE_FULL:
 	case ZONE_STATE_EMPTY:
 		change_zone_state(zns_ftl, zid, ZONE_STATE_EMPTY);
-		__reset_zone(zns_ftl, zid);
+		__reset_zone(ns, zns_ftl, zid);
 		break;
 
 	default:
@@ -227,8 +235,8 @@ static uint32_t __zmgmt_send_flush_explicit_zrwa(struct zns_ftl *zns_ftl, uint64
 	return status;
 }
 
-static uint32_t __zmgmt_send(struct zns_ftl *zns_ftl, uint64_t slba, uint32_t action,
-			     uint32_t option)
+static uint32_t __zmgmt_send(struct nvmev_ns *ns, struct zns_ftl *zns_ftl, uint64_t slba,
+			     uint32_t action, uint32_t option)
 {
 	uint32_t status;
 	uint64_t zid = lba_to_zone(zns_ftl, slba);
@@ -244,7 +252,7 @@ static uint32_t __zmgmt_send(struct zns_ftl *zns_ftl, uint64_t slba, uint32_t ac
 		status = __zmgmt_send_open_zone(zns_ftl, zid, option);
 		break;
 	case ZSA_RESET_ZONE:
-		status = __zmgmt_send_reset_zone(zns_ftl, zid);
+		status = __zmgmt_send_reset_zone(ns, zns_ftl, zid);
 		break;
 	case ZSA_OFFLINE_ZONE:
 		status = __zmgmt_send_offline_zone(zns_ftl, zid);
@@ -271,9 +279,9 @@ void zns_zmgmt_send(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev
 
 	if (select_all) {
 		for (zid = 0; zid < zns_ftl->zp.nr_zones; zid++)
-			__zmgmt_send(zns_ftl, zone_to_slba(zns_ftl, zid), action, option);
+			__zmgmt_send(ns, zns_ftl, zone_to_slba(zns_ftl, zid), action, option);
 	} else {
-		status = __zmgmt_send(zns_ftl, slba, action, option);
+		status = __zmgmt_send(ns, zns_ftl, slba, action, option);
 	}
 
 	NVMEV_ZNS_DEBUG("%s slba %llx zid %llu select_all %u action %u status %u option %u\n",
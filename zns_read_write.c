@@ -61,92 +61,48 @@ static inline struct ppa __lpn_to_ppa(struct zns_ftl *zns_ftl, uint64_t lpn)
 	return ppa;
 }
 
-static bool __zns_write(struct zns_ftl *zns_ftl, struct nvmev_request *req,
-			struct nvmev_result *ret)
+/*
+ * Check that [@slba, @slba + @nr_lba) may be written at the write pointer of
+ * its zone and open the zone if needed.
+ */
+static uint32_t __zns_prepare_write(struct zns_ftl *zns_ftl, uint64_t slba, uint64_t nr_lba)
 {
 	struct zone_descriptor *zone_descs = zns_ftl->zone_descs;
 	struct ssdparams *spp = &zns_ftl->ssd->sp;
-	struct nvme_rw_command *cmd = &(req->cmd->rw);
-
-	uint64_t slba = cmd->slba;
-	uint64_t nr_lba = __nr_lbas_from_rw_cmd(cmd);
-	uint64_t slpn, elpn, lpn, zone_elpn;
-	// get zone from start_lbai
 	uint32_t zid = lba_to_zone(zns_ftl, slba);
 	enum zone_state state = zone_descs[zid].state;
 
-	uint64_t nsecs_start = req->nsecs_start;
-	uint64_t nsecs_xfer_completed = nsecs_start;
-	uint64_t nsecs_latest = nsecs_start;
-	uint32_t status = NVME_SC_SUCCESS;
-
-	uint64_t pgs = 0;
-
-	struct buffer *write_buffer;
-
-	if (cmd->opcode == nvme_cmd_zone_append) {
-		slba = zone_descs[zid].wp;
-		cmd->slba = slba;
-	}
-
-	slpn = lba_to_lpn(zns_ftl, slba);
-	elpn = lba_to_lpn(zns_ftl, slba + nr_lba - 1);
-	zone_elpn = zone_to_elpn(zns_ftl, zid);
-
-	NVMEV_ZNS_DEBUG("%s slba 0x%llx nr_lba 0x%llx zone_id %d state %d\n", __func__, slba,
-			nr_lba, zid, state);
-
-	if (zns_ftl->zp.zone_wb_size)
-		write_buffer = &(zns_ftl->zone_write_buffer[zid]);
-	else
-		write_buffer = zns_ftl->ssd->write_buffer;
-
-	if (buffer_allocate(write_buffer, LBA_TO_BYTE(nr_lba)) < LBA_TO_BYTE(nr_lba))
-		return false;
-
-	if ((LBA_TO_BYTE(nr_lba) % spp->write_unit_size) != 0) {
-		status = NVME_SC_ZNS_INVALID_WRITE;
-		goto out;
-	}
+	if ((LBA_TO_BYTE(nr_lba) % spp->write_unit_size) != 0)
+		return NVME_SC_ZNS_INVALID_WRITE;
 
 	if (__check_boundary_error(zns_ftl, slba, nr_lba) == false) {
 		// return boundary error
-		status = NVME_SC_ZNS_ERR_BOUNDARY;
-		goto out;
+		return NVME_SC_ZNS_ERR_BOUNDARY;
 	}
 
 	// check if slba == current write pointer
 	if (slba != zone_descs[zid].wp) {
 		NVMEV_ERROR("%s WP error slba 0x%llx nr_lba 0x%llx zone_id %d wp %llx state %d\n",
 			    __func__, slba, nr_lba, zid, zns_ftl->zone_descs[zid].wp, state);
-		status = NVME_SC_ZNS_INVALID_WRITE;
-		goto out;
+		return NVME_SC_ZNS_INVALID_WRITE;
 	}
 
 	switch (state) {
 	case ZONE_STATE_EMPTY: {
 		// check if slba == start lba in zone
-		if (slba != zone_descs[zid].zslba) {
-			status = NVME_SC_ZNS_INVALID_WRITE;
-			goto out;
-		}
+		if (slba != zone_descs[zid].zslba)
+			return NVME_SC_ZNS_INVALID_WRITE;
 
-		if (is_zone_resource_full(zns_ftl, ACTIVE_ZONE)) {
-			status = NVME_SC_ZNS_NO_ACTIVE_ZONE;
-			goto out;
-		}
-		if (is_zone_resource_full(zns_ftl, OPEN_ZONE)) {
-			status = NVME_SC_ZNS_NO_OPEN_ZONE;
-			goto out;
-		}
+		if (is_zone_resource_full(zns_ftl, ACTIVE_ZONE))
+			return NVME_SC_ZNS_NO_ACTIVE_ZONE;
+		if (is_zone_resource_full(zns_ftl, OPEN_ZONE))
+			return NVME_SC_ZNS_NO_OPEN_ZONE;
 		acquire_zone_resource(zns_ftl, ACTIVE_ZONE);
 		// go through
 	}
 	case ZONE_STATE_CLOSED: {
-		if (acquire_zone_resource(zns_ftl, OPEN_ZONE) == false) {
-			status = NVME_SC_ZNS_NO_OPEN_ZONE;
-			goto out;
-		}
+		if (acquire_zone_resource(zns_ftl, OPEN_ZONE) == false)
+			return NVME_SC_ZNS_NO_OPEN_ZONE;
 
 		// change to ZSIO
 		change_zone_state(zns_ftl, zid, ZONE_STATE_OPENED_IMPL);
@@ -157,22 +113,30 @@ static bool __zns_write(struct zns_ftl *zns_ftl, struct nvmev_request *req,
 		break;
 	}
 	case ZONE_STATE_FULL:
-		status = NVME_SC_ZNS_ERR_FULL;
-		goto out;
+		return NVME_SC_ZNS_ERR_FULL;
 	case ZONE_STATE_READ_ONLY:
-		status = NVME_SC_ZNS_ERR_READ_ONLY;
-		goto out;
+		return NVME_SC_ZNS_ERR_READ_ONLY;
 	case ZONE_STATE_OFFLINE:
-		status = NVME_SC_ZNS_ERR_OFFLINE;
-		goto out;
+		return NVME_SC_ZNS_ERR_OFFLINE;
 	}
 
-	__increase_write_ptr(zns_ftl, zid, nr_lba);
+	return NVME_SC_SUCCESS;
+}
 
-	// get delay from nand model
-	nsecs_latest = nsecs_start;
-	nsecs_latest = ssd_advance_write_buffer(zns_ftl->ssd, nsecs_latest, LBA_TO_BYTE(nr_lba));
-	nsecs_xfer_completed = nsecs_latest;
+/*
+ * Program the LPNs in [@slpn, @elpn] of zone @zid from @stime. With
+ * @buffered, the data hold write buffer of the zone. The buffer held by a
+ * wordline is released once it gets programmed. Returns when the last
+ * program completes.
+ */
+static uint64_t __zns_program(struct zns_ftl *zns_ftl, uint32_t zid, uint64_t slpn, uint64_t elpn,
+			      uint64_t stime, int sqid, bool buffered)
+{
+	uint32_t *nr_buffered = &zns_ftl->zone_nr_buffered[zid];
+	struct ssdparams *spp = &zns_ftl->ssd->sp;
+	uint64_t zone_elpn = zone_to_elpn(zns_ftl, zid);
+	uint64_t nsecs_latest = stime;
+	uint64_t lpn, pgs = 0;
 
 	for (lpn = slpn; lpn <= elpn; lpn += pgs) {
 		struct ppa ppa;
@@ -181,36 +145,87 @@ static bool __zns_write(struct zns_ftl *zns_ftl, struct nvmev_request *req,
 		ppa = __lpn_to_ppa(zns_ftl, lpn);
 		pg_off = ppa.g.pg % spp->pgs_per_oneshotpg;
 		pgs = min(elpn - lpn + 1, (uint64_t)(spp->pgs_per_oneshotpg - pg_off));
+		if (buffered)
+			*nr_buffered += pgs;
 
 		/* Aggregate write io in flash page */
 		if (((pg_off + pgs) == spp->pgs_per_oneshotpg) || ((lpn + pgs - 1) == zone_elpn)) {
 			struct nand_cmd swr = {
 				.type = USER_IO,
 				.cmd = NAND_WRITE,
-				.stime = nsecs_xfer_completed,
+				.stime = stime,
 				.xfer_size = spp->pgs_per_oneshotpg * spp->pgsz,
 				.interleave_pci_dma = false,
 				.ppa = &ppa,
 			};
-			size_t bufs_to_release;
-			uint32_t unaligned_space =
-				zns_ftl->zp.zone_size % (spp->pgs_per_oneshotpg * spp->pgsz);
 			uint64_t nsecs_completed = ssd_advance_nand(zns_ftl->ssd, &swr);
 
 			nsecs_latest = max(nsecs_completed, nsecs_latest);
-			NVMEV_ZNS_DEBUG("%s Flush slba 0x%llx nr_lba 0x%llx zone_id %d state %d\n",
-					__func__, slba, nr_lba, zid, state);
+			NVMEV_ZNS_DEBUG("%s Flush lpn 0x%llx zone_id %d\n", __func__, lpn, zid);
+
+			/* Copies share the wordline but never held any buffer */
+			if (*nr_buffered)
+				schedule_internal_operation(sqid, nsecs_completed,
+							    zone_to_write_buffer(zns_ftl, zid),
+							    *nr_buffered * spp->pgsz);
+			*nr_buffered = 0;
+		}
+	}
 
-			if (((lpn + pgs - 1) == zone_elpn) && (unaligned_space > 0))
-				bufs_to_release = unaligned_space;
-			else
-				bufs_to_release = spp->pgs_per_oneshotpg * spp->pgsz;
+	return nsecs_latest;
+}
 
-			schedule_internal_operation(req->sq_id, nsecs_completed, write_buffer,
-						    bufs_to_release);
-		}
+static bool __zns_write(struct zns_ftl *zns_ftl, struct nvmev_request *req,
+			struct nvmev_result *ret)
+{
+	struct zone_descriptor *zone_descs = zns_ftl->zone_descs;
+	struct ssdparams *spp = &zns_ftl->ssd->sp;
+	struct nvme_rw_command *cmd = &(req->cmd->rw);
+
+	uint64_t slba = cmd->slba;
+	uint64_t nr_lba = __nr_lbas_from_rw_cmd(cmd);
+	uint64_t slpn, elpn;
+	// get zone from start_lbai
+	uint32_t zid = lba_to_zone(zns_ftl, slba);
+
+	uint64_t nsecs_start = req->nsecs_start;
+	uint64_t nsecs_xfer_completed = nsecs_start;
+	uint64_t nsecs_latest = nsecs_start;
+	uint32_t status = NVME_SC_SUCCESS;
+
+	struct buffer *write_buffer;
+
+	if (cmd->opcode == nvme_cmd_zone_append) {
+		slba = zone_descs[zid].wp;
+		cmd->slba = slba;
 	}
 
+	slpn = lba_to_lpn(zns_ftl, slba);
+	elpn = lba_to_lpn(zns_ftl, slba + nr_lba - 1);
+
+	NVMEV_ZNS_DEBUG("%s slba 0x%llx nr_lba 0x%llx zone_id %d state %d\n", __func__, slba,
+			nr_lba, zid, zone_descs[zid].state);
+
+	write_buffer = zone_to_write_buffer(zns_ftl, zid);
+	if (buffer_allocate(write_buffer, LBA_TO_BYTE(nr_lba)) < LBA_TO_BYTE(nr_lba))
+		return false;
+
+	status = __zns_prepare_write(zns_ftl, slba, nr_lba);
+	if (status != NVME_SC_SUCCESS) {
+		buffer_release(write_buffer, LBA_TO_BYTE(nr_lba));
+		goto out;
+	}
+
+	__increase_write_ptr(zns_ftl, zid, nr_lba);
+
+	// get delay from nand model
+	nsecs_latest = nsecs_start;
+	nsecs_latest = ssd_advance_write_buffer(zns_ftl->ssd, nsecs_latest, LBA_TO_BYTE(nr_lba));
+	nsecs_xfer_completed = nsecs_latest;
+
+	nsecs_latest = __zns_program(zns_ftl, zid, slpn, elpn, nsecs_xfer_completed, req->sq_id,
+				     true);
+
 out:
 	ret->status = status;
 	if ((cmd->control & NVME_RW_FUA) ||
@@ -397,6 +412,28 @@ bool zns_write(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_resu
 		return __zns_write_zrwa(zns_ftl, req, ret);
 }
 
+/* Issue the NAND reads of the LPNs in [@slpn, @elpn] from @srd->stime */
+static uint64_t __zns_read_lpns(struct zns_ftl *zns_ftl, uint64_t slpn, uint64_t elpn,
+				struct nand_cmd *srd)
+{
+	struct ssdparams *spp = &zns_ftl->ssd->sp;
+	uint64_t nsecs_completed, nsecs_latest = srd->stime;
+	uint64_t lpn, pgs = 0, pg_off;
+	struct ppa ppa;
+
+	for (lpn = slpn; lpn <= elpn; lpn += pgs) {
+		ppa = __lpn_to_ppa(zns_ftl, lpn);
+		pg_off = ppa.g.pg % spp->pgs_per_flashpg;
+		pgs = min(elpn - lpn + 1, (uint64_t)(spp->pgs_per_flashpg - pg_off));
+		srd->xfer_size = pgs * spp->pgsz;
+		srd->ppa = &ppa;
+		nsecs_completed = ssd_advance_nand(zns_ftl->ssd, srd);
+		nsecs_latest = (nsecs_completed > nsecs_latest) ? nsecs_completed : nsecs_latest;
+	}
+
+	return nsecs_latest;
+}
+
 bool zns_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
 {
 	struct zns_ftl *zns_ftl = (struct zns_ftl *)ns->ftls;
@@ -409,15 +446,12 @@ bool zns_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_resul
 
 	uint64_t slpn = lba_to_lpn(zns_ftl, slba);
 	uint64_t elpn = lba_to_lpn(zns_ftl, slba + nr_lba - 1);
-	uint64_t lpn;
 
 	// get zone from start_lba
 	uint32_t zid = lpn_to_zone(zns_ftl, slpn);
 	uint32_t status = NVME_SC_SUCCESS;
 	uint64_t nsecs_start = req->nsecs_start;
 	uint64_t nsecs_completed = nsecs_start, nsecs_latest = 0;
-	uint64_t pgs = 0, pg_off;
-	struct ppa ppa;
 	struct nand_cmd swr;
 
 	NVMEV_ZNS_DEBUG(
@@ -444,15 +478,7 @@ bool zns_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_resul
 	swr.stime = nsecs_latest;
 	swr.interleave_pci_dma = false;
 
-	for (lpn = slpn; lpn <= elpn; lpn += pgs) {
-		ppa = __lpn_to_ppa(zns_ftl, lpn);
-		pg_off = ppa.g.pg % spp->pgs_per_flashpg;
-		pgs = min(elpn - lpn + 1, (uint64_t)(spp->pgs_per_flashpg - pg_off));
-		swr.xfer_size = pgs * spp->pgsz;
-		swr.ppa = &ppa;
-		nsecs_completed = ssd_advance_nand(zns_ftl->ssd, &swr);
-		nsecs_latest = (nsecs_completed > nsecs_latest) ? nsecs_completed : nsecs_latest;
-	}
+	nsecs_latest = __zns_read_lpns(zns_ftl, slpn, elpn, &swr);
 
 	if (swr.interleave_pci_dma == false) {
 		nsecs_completed = ssd_advance_pcie(zns_ftl->ssd, nsecs_latest, nr_lba * spp->secsz);
@@ -463,3 +489,158 @@ bool zns_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_resul
 	ret->nsecs_target = nsecs_latest;
 	return true;
 }
+
+/*
+ * Write Zeroes advances the zone like a write, but no data come from the host:
+ * there is no PCIe transfer and no write buffer is taken.
+ */
+bool zns_write_zeroes(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+{
+	struct zns_ftl *zns_ftl = (struct zns_ftl *)ns->ftls;
+	struct ssdparams *spp = &zns_ftl->ssd->sp;
+	struct nvme_rw_command *cmd = &(req->cmd->rw);
+	uint64_t slba = cmd->slba;
+	uint64_t nr_lba = __nr_lbas_from_rw_cmd(cmd);
+	uint32_t zid = lba_to_zone(zns_ftl, slba);
+
+	ret->nsecs_target = req->nsecs_start;
+
+	if (slba >= BYTE_TO_LBA(ns->size) || nr_lba > BYTE_TO_LBA(ns->size) - slba) {
+		ret->status = NVME_SC_LBA_RANGE;
+		return true;
+	}
+	if (zns_ftl->zone_descs[zid].zrwav) {
+		/* ZRWA zones take their data through the ZRWA buffer only */
+		ret->status = NVME_SC_ZNS_INVALID_WRITE;
+		return true;
+	}
+
+	ret->status = __zns_prepare_write(zns_ftl, slba, nr_lba);
+	if (ret->status != NVME_SC_SUCCESS)
+		return true;
+
+	__increase_write_ptr(zns_ftl, zid, nr_lba);
+	ret->nsecs_target = __zns_program(zns_ftl, zid, lba_to_lpn(zns_ftl, slba),
+					  lba_to_lpn(zns_ftl, slba + nr_lba - 1),
+					  req->nsecs_start + spp->fw_wbuf_lat0, req->sq_id, false);
+
+	nvmev_zero_range(ns, LBA_TO_BYTE(slba), LBA_TO_BYTE(nr_lba));
+	return true;
+}
+
+/*
+ * Simple Copy: the source ranges are read from NAND and appended at the write
+ * pointer of the destination zone, without PCIe transfers or the write
+ * buffer. Zone GC can be done by the host this way without moving data.
+ */
+bool zns_copy(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+{
+	struct zns_ftl *zns_ftl = (struct zns_ftl *)ns->ftls;
+	struct ssdparams *spp = &zns_ftl->ssd->sp;
+	struct zone_descriptor *zone_descs = zns_ftl->zone_descs;
+	struct nvme_copy_command *cmd = &(req->cmd->copy);
+	uint32_t nr_ranges = cmd->nr_range + 1;
+	uint64_t dlba = cmd->sdlba;
+	uint64_t nr_lba = 0;
+	uint32_t zid, i;
+	uint64_t nsecs_latest;
+	struct nvme_copy_range *ranges;
+	struct nand_cmd srd = {
+		.type = USER_IO,
+		.cmd = NAND_READ,
+		.stime = req->nsecs_start + spp->fw_rd_lat,
+		.interleave_pci_dma = false,
+	};
+
+	ret->nsecs_target = req->nsecs_start;
+	ret->status = NVME_SC_SUCCESS;
+
+	if (cmd->format != 0) {
+		ret->status = NVME_SC_INVALID_FIELD;
+		return true;
+	}
+	if (nr_ranges > NVMEV_MSRC + 1) {
+		ret->status = NVME_SC_CMD_SIZE_LIMIT;
+		return true;
+	}
+	if (lba_to_zone(zns_ftl, dlba) >= zns_ftl->zp.nr_zones) {
+		ret->status = NVME_SC_LBA_RANGE;
+		return true;
+	}
+
+	/* Called under zns_ftl->lock */
+	ranges = kmalloc_array(nr_ranges, sizeof(*ranges), GFP_ATOMIC);
+	if (!ranges)
+		return false;
+
+	ret->status = nvmev_dptr_copy(cmd->flags, cmd->prp1, cmd->prp2, ranges,
+				      nr_ranges * sizeof(*ranges), true, NVMEV_COPY_MEMCPY);
+	if (ret->status != NVME_SC_SUCCESS)
+		goto out;
+
+	for (i = 0; i < nr_ranges; i++) {
+		uint64_t slba = ranges[i].slba;
+		uint64_t nlb = ranges[i].nlb + 1;
+
+		if (nlb > NVMEV_MSSRL) {
+			ret->status = NVME_SC_CMD_SIZE_LIMIT;
+			goto out;
+		}
+		if (lba_to_zone(zns_ftl, slba + nlb - 1) >= zns_ftl->zp.nr_zones) {
+			ret->status = NVME_SC_LBA_RANGE;
+			goto out;
+		}
+		if (__check_boundary_error(zns_ftl, slba, nlb) == false) {
+			ret->status = NVME_SC_ZNS_ERR_BOUNDARY;
+			goto out;
+		}
+		if (zone_descs[lba_to_zone(zns_ftl, slba)].state == ZONE_STATE_OFFLINE) {
+			ret->status = NVME_SC_ZNS_ERR_OFFLINE;
+			goto out;
+		}
+		nr_lba += nlb;
+	}
+	if (nr_lba > NVMEV_MCL) {
+		ret->status = NVME_SC_CMD_SIZE_LIMIT;
+		goto out;
+	}
+
+	zid = lba_to_zone(zns_ftl, dlba);
+	if (zone_descs[zid].zrwav) {
+		/* ZRWA zones take their data through the ZRWA buffer only */
+		ret->status = NVME_SC_ZNS_INVALID_WRITE;
+		goto out;
+	}
+
+	ret->status = __zns_prepare_write(zns_ftl, dlba, nr_lba);
+	if (ret->status != NVME_SC_SUCCESS)
+		goto out;
+
+	/* All the sources are read before the destination is programmed */
+	nsecs_latest = srd.stime;
+	for (i = 0; i < nr_ranges; i++) {
+		uint64_t slba = ranges[i].slba;
+		uint64_t nlb = ranges[i].nlb + 1;
+		uint64_t nsecs_completed = __zns_read_lpns(zns_ftl, lba_to_lpn(zns_ftl, slba),
+							   lba_to_lpn(zns_ftl, slba + nlb - 1), &srd);
+
+		nsecs_latest = max(nsecs_latest, nsecs_completed);
+	}
+
+	__increase_write_ptr(zns_ftl, zid, nr_lba);
+	ret->nsecs_target = __zns_program(zns_ftl, zid, lba_to_lpn(zns_ftl, dlba),
+					  lba_to_lpn(zns_ftl, dlba + nr_lba - 1), nsecs_latest,
+					  req->sq_id, false);
+
+	for (i = 0; i < nr_ranges; i++) {
+		uint64_t nlb = ranges[i].nlb + 1;
+
+		nvmev_move_range(ns, LBA_TO_BYTE(dlba), LBA_TO_BYTE(ranges[i].slba),
+				 LBA_TO_BYTE(nlb));
+		dlba += nlb;
+	}
+
+out:
+	kfree(ranges);
+	return true;
+}